@@ -15,12 +15,114 @@
 #ifndef ALLOC_H
 #define ALLOC_H
 
+#if !defined(_WIN32) && !defined(_DEFAULT_SOURCE)
+#define _DEFAULT_SOURCE
+#endif
+
 #include <stddef.h>
 #include <stdint.h>
+#include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <time.h>
 #include <assert.h>
 
+#if defined(__GLIBC__)
+#include <malloc.h>
+#elif defined(__APPLE__)
+#include <malloc/malloc.h>
+#endif
+
+#if defined(_MSC_VER)
+#include <intrin.h>
+#elif defined(__AVX2__)
+#include <immintrin.h>
+#elif defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+#if defined(_WIN32)
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <pthread.h>
+#include <sched.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+#if defined(__linux__)
+#include <sys/syscall.h>
+#endif
+
+#if !defined(_WIN32) && !defined(MAP_ANONYMOUS) && defined(MAP_ANON)
+#define MAP_ANONYMOUS MAP_ANON
+#endif
+
+#if defined(__GLIBC__) || defined(__APPLE__)
+#include <execinfo.h>
+#endif
+
+#if defined(__SANITIZE_ADDRESS__)
+#define ALLOC_HAS_ASAN 1
+#elif defined(__has_feature)
+#if __has_feature(address_sanitizer)
+#define ALLOC_HAS_ASAN 1
+#endif
+#endif
+
+#if defined(ALLOC_DEBUG) && defined(ALLOC_HAS_ASAN)
+#include <sanitizer/asan_interface.h>
+#define ALLOC_ASAN_POISON(ptr, size) ASAN_POISON_MEMORY_REGION((ptr), (size))
+#define ALLOC_ASAN_UNPOISON(ptr, size) \
+  ASAN_UNPOISON_MEMORY_REGION((ptr), (size))
+#else
+#define ALLOC_ASAN_POISON(ptr, size) ((void)(ptr), (void)(size))
+#define ALLOC_ASAN_UNPOISON(ptr, size) ((void)(ptr), (void)(size))
+#endif
+
+#if defined(__cplusplus)
+#include <atomic>
+#include <new>
+#if __cplusplus >= 201703L && defined(__has_include)
+#if __has_include(<memory_resource>)
+#include <memory_resource>
+#define ALLOC_HAS_PMR 1
+#endif
+#endif
+#define ALLOC_ATOMIC(T) std::atomic<T>
+using std::atomic_compare_exchange_weak_explicit;
+using std::atomic_exchange_explicit;
+using std::atomic_fetch_add_explicit;
+using std::atomic_fetch_sub_explicit;
+using std::atomic_init;
+using std::atomic_load_explicit;
+using std::atomic_store_explicit;
+using std::memory_order_acq_rel;
+using std::memory_order_acquire;
+using std::memory_order_relaxed;
+using std::memory_order_release;
+#else
+#include <stdatomic.h>
+#define ALLOC_ATOMIC(T) _Atomic(T)
+#endif
+
+#if defined(__cplusplus)
+#define ALLOC_THREAD_LOCAL thread_local
+#elif defined(_MSC_VER)
+#define ALLOC_THREAD_LOCAL __declspec(thread)
+#else
+#define ALLOC_THREAD_LOCAL _Thread_local
+#endif
+
+/* Getters leave optional slots out of their designated initializers, which
+ * g++ -Wextra reports even though C++20 zero-initializes them. */
+#if defined(__cplusplus) && defined(__GNUC__)
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wmissing-field-initializers"
+#endif
+
 typedef struct allocator allocator;
 
 struct allocator {
@@ -29,6 +131,11 @@ struct allocator {
                    size_t alignment);
   void (*free)(allocator* self, void* ptr, size_t size);
   void* ctx;
+  /* Optional slots; leave NULL to fall back to alloc and free. */
+  size_t (*alloc_batch)(allocator* self, size_t size, size_t alignment,
+                        void** out, size_t count);
+  void (*free_batch)(allocator* self, void** ptrs, size_t size, size_t count);
+  void* (*alloc_zeroed)(allocator* self, size_t size, size_t alignment);
 };
 
 static inline void* alloc_alloc(allocator* a, size_t size, size_t alignment) {
@@ -44,6 +151,58 @@ static inline void alloc_free(allocator* a, void* ptr, size_t size) {
   a->free(a, ptr, size);
 }
 
+static inline size_t alloc_alloc_batch(allocator* a, size_t size,
+                                       size_t alignment, void** out,
+                                       size_t count) {
+  if (a->alloc_batch) {
+    return a->alloc_batch(a, size, alignment, out, count);
+  }
+
+  size_t i = 0;
+  while (i < count && (out[i] = a->alloc(a, size, alignment)) != NULL) {
+    i++;
+  }
+
+  return i;
+}
+
+static inline void alloc_free_batch(allocator* a, void** ptrs, size_t size,
+                                    size_t count) {
+  if (a->free_batch) {
+    a->free_batch(a, ptrs, size, count);
+    return;
+  }
+
+  for (size_t i = 0; i < count; i++) {
+    if (ptrs[i]) {
+      a->free(a, ptrs[i], size);
+    }
+  }
+}
+
+static inline void* alloc_alloc_zeroed(allocator* a, size_t size,
+                                       size_t alignment) {
+  if (a->alloc_zeroed) {
+    return a->alloc_zeroed(a, size, alignment);
+  }
+
+  void* ptr = a->alloc(a, size, alignment);
+  if (ptr) {
+    memset(ptr, 0, size);
+  }
+
+  return ptr;
+}
+
+static inline void* alloc_calloc(allocator* a, size_t count,
+                                 size_t elem_size) {
+  if (elem_size && count > SIZE_MAX / elem_size) {
+    return NULL;
+  }
+
+  return alloc_alloc_zeroed(a, count * elem_size, sizeof(void*));
+}
+
 static inline void* alloc_alloc_aligned(allocator* a, size_t size,
                                         size_t alignment) {
   return alloc_alloc(a, size, alignment);
@@ -65,13 +224,14 @@ static inline void alloc_destroy(allocator* a, void* ptr, size_t size) {
 static void* c_allocator_alloc(allocator* self, size_t size, size_t alignment) {
   (void)self;
 
+#if defined(_WIN32)
+  return _aligned_malloc(size,
+                         alignment < sizeof(void*) ? sizeof(void*) : alignment);
+#else
   if (alignment <= sizeof(void*)) {
     return malloc(size);
   }
 
-#if defined(_WIN32)
-  return _aligned_malloc(size, alignment);
-#else
   void* ptr = NULL;
   if (posix_memalign(&ptr, alignment, size) == 0)
     return ptr;
@@ -79,28 +239,63 @@ static void* c_allocator_alloc(allocator* self, size_t size, size_t alignment) {
 #endif
 }
 
+static void* c_allocator_alloc_zeroed(allocator* self, size_t size,
+                                      size_t alignment) {
+#if !defined(_WIN32)
+  if (alignment <= sizeof(void*)) {
+    return calloc(1, size);
+  }
+#endif
+
+  void* ptr = c_allocator_alloc(self, size, alignment);
+  if (ptr) {
+    memset(ptr, 0, size);
+  }
+
+  return ptr;
+}
+
+static size_t c_allocator_usable_size(void* ptr) {
+#if defined(__GLIBC__)
+  return malloc_usable_size(ptr);
+#elif defined(__APPLE__)
+  return malloc_size(ptr);
+#else
+  (void)ptr;
+  return 0;
+#endif
+}
+
 static void* c_allocator_realloc(allocator* self, void* ptr, size_t old_size,
                                  size_t new_size, size_t alignment) {
   (void)self;
-  (void)old_size;
 
+#if defined(_WIN32)
+  (void)old_size;
+  return _aligned_realloc(
+      ptr, new_size, alignment < sizeof(void*) ? sizeof(void*) : alignment);
+#else
   if (alignment <= sizeof(void*)) {
     return realloc(ptr, new_size);
   }
 
+  if (!ptr) {
+    return c_allocator_alloc(self, new_size, alignment);
+  }
+
+  if (new_size <= c_allocator_usable_size(ptr)) {
+    return ptr;
+  }
+
   void* new_ptr = c_allocator_alloc(self, new_size, alignment);
 
-  if (new_ptr && ptr) {
+  if (new_ptr) {
     memcpy(new_ptr, ptr, old_size < new_size ? old_size : new_size);
-    c_allocator_alloc(self, 0, alignment);
-#if defined(_WIN32)
-    _aligned_free(ptr);
-#else
     free(ptr);
-#endif
   }
 
   return new_ptr;
+#endif
 }
 
 static void c_allocator_free(allocator* self, void* ptr, size_t size) {
@@ -119,487 +314,6106 @@ static void c_allocator_free(allocator* self, void* ptr, size_t size) {
 static allocator c_allocator_instance = {.alloc = c_allocator_alloc,
                                          .realloc = c_allocator_realloc,
                                          .free = c_allocator_free,
-                                         .ctx = NULL};
+                                         .ctx = NULL,
+                                         .alloc_zeroed =
+                                             c_allocator_alloc_zeroed};
 
 static inline allocator* c_allocator(void) {
   return &c_allocator_instance;
 }
 
-typedef struct arena_allocator {
-  uint8_t* buffer;
-  size_t buffer_size;
-  size_t offset;
-  allocator* backing;
-} arena_allocator;
+static inline size_t align_forward(size_t ptr, size_t alignment) {
+  return (ptr + alignment - 1) & ~(alignment - 1);
+}
 
-static size_t align_forward(size_t ptr, size_t alignment) {
-  size_t modulo = ptr & (alignment - 1);
+#define ALLOC_ZERO_STREAM_THRESHOLD ((size_t)256 * 1024)
+
+/* Large ranges are zeroed with non-temporal stores so clearing a block does
+ * not evict the working set; the caller touches the memory later anyway. */
+static void alloc_zero_memory(void* ptr, size_t size) {
+#if defined(__AVX2__) || defined(__SSE2__) || defined(_M_X64)
+  if (size >= ALLOC_ZERO_STREAM_THRESHOLD) {
+    uint8_t* bytes = (uint8_t*)ptr;
+    size_t head = align_forward((uintptr_t)bytes, 32) - (uintptr_t)bytes;
+
+    memset(bytes, 0, head);
+    bytes += head;
+    size -= head;
+
+#if defined(__AVX2__)
+    __m256i zero = _mm256_setzero_si256();
+    for (; size >= 128; size -= 128, bytes += 128) {
+      _mm256_stream_si256((__m256i*)bytes, zero);
+      _mm256_stream_si256((__m256i*)(bytes + 32), zero);
+      _mm256_stream_si256((__m256i*)(bytes + 64), zero);
+      _mm256_stream_si256((__m256i*)(bytes + 96), zero);
+    }
+#else
+    __m128i zero = _mm_setzero_si128();
+    for (; size >= 64; size -= 64, bytes += 64) {
+      _mm_stream_si128((__m128i*)bytes, zero);
+      _mm_stream_si128((__m128i*)(bytes + 16), zero);
+      _mm_stream_si128((__m128i*)(bytes + 32), zero);
+      _mm_stream_si128((__m128i*)(bytes + 48), zero);
+    }
+#endif
 
-  if (modulo != 0) {
-    ptr += alignment - modulo;
+    _mm_sfence();
+    memset(bytes, 0, size);
+    return;
   }
+#endif
 
-  return ptr;
+  memset(ptr, 0, size);
 }
 
-static void* arena_allocator_alloc(allocator* self, size_t size,
-                                   size_t alignment) {
-  arena_allocator* arena = (arena_allocator*)self->ctx;
+#if defined(_WIN32)
+typedef SRWLOCK alloc_mutex;
+typedef DWORD alloc_tls_key;
+typedef INIT_ONCE alloc_once;
+#define ALLOC_ONCE_INIT INIT_ONCE_STATIC_INIT
+#else
+typedef pthread_mutex_t alloc_mutex;
+typedef pthread_key_t alloc_tls_key;
+typedef pthread_once_t alloc_once;
+#define ALLOC_ONCE_INIT PTHREAD_ONCE_INIT
+#endif
 
-  size_t aligned_offset = align_forward(arena->offset, alignment);
+#if defined(_WIN32)
+static BOOL CALLBACK alloc_once_thunk(PINIT_ONCE once, PVOID fn,
+                                      PVOID* context) {
+  (void)once;
+  (void)context;
+  ((void (*)(void))fn)();
+  return TRUE;
+}
+#endif
 
-  if (aligned_offset + size > arena->buffer_size) {
-    return NULL;
-  }
+static inline void alloc_call_once(alloc_once* once, void (*fn)(void)) {
+#if defined(_WIN32)
+  InitOnceExecuteOnce(once, alloc_once_thunk, (PVOID)fn, NULL);
+#else
+  pthread_once(once, fn);
+#endif
+}
 
-  void* ptr = arena->buffer + aligned_offset;
-  arena->offset = aligned_offset + size;
+static inline void alloc_mutex_init(alloc_mutex* mutex) {
+#if defined(_WIN32)
+  InitializeSRWLock(mutex);
+#else
+  pthread_mutex_init(mutex, NULL);
+#endif
+}
 
-  return ptr;
+static inline void alloc_mutex_destroy(alloc_mutex* mutex) {
+#if defined(_WIN32)
+  (void)mutex;
+#else
+  pthread_mutex_destroy(mutex);
+#endif
 }
 
-static void* arena_allocator_realloc(allocator* self, void* ptr,
-                                     size_t old_size, size_t new_size,
-                                     size_t alignment) {
-  arena_allocator* arena = (arena_allocator*)self->ctx;
+static inline void alloc_mutex_lock(alloc_mutex* mutex) {
+#if defined(_WIN32)
+  AcquireSRWLockExclusive(mutex);
+#else
+  pthread_mutex_lock(mutex);
+#endif
+}
 
-  if (!ptr) {
-    return arena_allocator_alloc(self, new_size, alignment);
-  }
+static inline void alloc_mutex_unlock(alloc_mutex* mutex) {
+#if defined(_WIN32)
+  ReleaseSRWLockExclusive(mutex);
+#else
+  pthread_mutex_unlock(mutex);
+#endif
+}
 
-  uint8_t* byte_ptr = (uint8_t*)ptr;
+static inline int alloc_tls_create(alloc_tls_key* key,
+                                   void (*destructor)(void*)) {
+#if defined(_WIN32)
+  *key = FlsAlloc((PFLS_CALLBACK_FUNCTION)destructor);
+  return *key != FLS_OUT_OF_INDEXES;
+#else
+  return pthread_key_create(key, destructor) == 0;
+#endif
+}
 
-  if (byte_ptr + old_size == arena->buffer + arena->offset) {
-    size_t aligned_offset =
-        align_forward((size_t)(byte_ptr - arena->buffer), alignment);
-    if (aligned_offset + new_size <= arena->buffer_size) {
-      arena->offset = aligned_offset + new_size;
-      return ptr;
-    }
-  }
+static inline void alloc_tls_delete(alloc_tls_key key) {
+#if defined(_WIN32)
+  FlsFree(key);
+#else
+  pthread_key_delete(key);
+#endif
+}
 
-  void* new_ptr = arena_allocator_alloc(self, new_size, alignment);
-  if (new_ptr && ptr) {
-    memcpy(new_ptr, ptr, old_size < new_size ? old_size : new_size);
-  }
+static inline void* alloc_tls_get(alloc_tls_key key) {
+#if defined(_WIN32)
+  return FlsGetValue(key);
+#else
+  return pthread_getspecific(key);
+#endif
+}
 
-  return new_ptr;
+static inline void alloc_tls_set(alloc_tls_key key, void* value) {
+#if defined(_WIN32)
+  FlsSetValue(key, value);
+#else
+  pthread_setspecific(key, value);
+#endif
 }
 
-static void arena_allocator_free(allocator* self, void* ptr, size_t size) {
-  (void)self;
+#define ALLOC_CACHE_LINE_SIZE ((size_t)64)
+#define ALLOC_MAX_NUMA_NODES 1024
+
+/* Binds the whole pages inside [ptr, ptr + size) to node. Partial pages at
+ * either end may hold unrelated data and are left alone. Returns 0 when
+ * binding fails or no whole page lies in the range. */
+static int alloc_bind_node(void* ptr, size_t size, int node) {
+#if defined(__linux__) && defined(SYS_mbind)
+  if (node < 0 || node >= ALLOC_MAX_NUMA_NODES || size == 0) {
+    return 0;
+  }
+
+  unsigned long mask[ALLOC_MAX_NUMA_NODES / (8 * sizeof(unsigned long))];
+  memset(mask, 0, sizeof(mask));
+  mask[node / (8 * sizeof(unsigned long))] |=
+      1UL << (node % (8 * sizeof(unsigned long)));
+
+  size_t page_size = (size_t)sysconf(_SC_PAGESIZE);
+  uintptr_t start = align_forward((uintptr_t)ptr, page_size);
+  uintptr_t end = ((uintptr_t)ptr + size) & ~(uintptr_t)(page_size - 1);
+
+  if (end <= start) {
+    return 0;
+  }
+
+  return syscall(SYS_mbind, (void*)start, (unsigned long)(end - start), 2,
+                 mask, (unsigned long)ALLOC_MAX_NUMA_NODES + 1, 2) == 0;
+#else
   (void)ptr;
   (void)size;
+  (void)node;
+  return 0;
+#endif
 }
 
-static void arena_allocator_reset(arena_allocator* arena) {
-  arena->offset = 0;
+#define PAGE_ALLOCATOR_HUGETLB 1
+#define PAGE_ALLOCATOR_TRANSPARENT_HUGE 2
+
+typedef struct page_allocator {
+  size_t page_size;
+  size_t huge_page_size;
+  int flags;
+  int numa_node;
+} page_allocator;
+
+static size_t page_allocator_round(page_allocator* pages, size_t size) {
+  size_t granularity =
+      pages->flags & PAGE_ALLOCATOR_HUGETLB ? pages->huge_page_size
+                                            : pages->page_size;
+  return (size + granularity - 1) & ~(granularity - 1);
 }
 
-static void arena_allocator_init(arena_allocator* arena, void* buffer,
-                                 size_t size) {
-  arena->buffer = (uint8_t*)buffer;
-  arena->buffer_size = size;
-  arena->offset = 0;
-  arena->backing = NULL;
-}
+static void* page_allocator_map(page_allocator* pages, size_t size,
+                                size_t alignment) {
+#if defined(_WIN32)
+  if (pages->flags & PAGE_ALLOCATOR_HUGETLB) {
+    void* ptr = VirtualAlloc(NULL, size,
+                             MEM_RESERVE | MEM_COMMIT | MEM_LARGE_PAGES,
+                             PAGE_READWRITE);
+    if (ptr)
+      return ptr;
+  }
 
-static allocator arena_allocator_get(arena_allocator* arena) {
-  allocator alloc = {.alloc = arena_allocator_alloc,
-                     .realloc = arena_allocator_realloc,
-                     .free = arena_allocator_free,
-                     .ctx = arena};
-  return alloc;
-}
+  if (alignment <= pages->page_size) {
+    if (pages->numa_node >= 0) {
+      return VirtualAllocExNuma(GetCurrentProcess(), NULL, size,
+                                MEM_RESERVE | MEM_COMMIT, PAGE_READWRITE,
+                                (DWORD)pages->numa_node);
+    }
 
-typedef struct pool_allocator {
-  uint8_t* buffer;
-  size_t chunk_size;
-  size_t chunk_count;
-  void** free_list;
-  allocator* backing;
-} pool_allocator;
+    return VirtualAlloc(NULL, size, MEM_RESERVE | MEM_COMMIT, PAGE_READWRITE);
+  }
 
-static void pool_allocator_free(allocator* self, void* ptr, size_t size);
+  for (int attempt = 0; attempt < 8; attempt++) {
+    uint8_t* probe = (uint8_t*)VirtualAlloc(NULL, size + alignment,
+                                            MEM_RESERVE, PAGE_NOACCESS);
+    if (!probe)
+      return NULL;
 
-static void* pool_allocator_alloc(allocator* self, size_t size,
-                                  size_t alignment) {
-  pool_allocator* pool = (pool_allocator*)self->ctx;
-  (void)alignment;
+    VirtualFree(probe, 0, MEM_RELEASE);
+    void* ptr = VirtualAlloc((void*)align_forward((uintptr_t)probe, alignment),
+                             size, MEM_RESERVE | MEM_COMMIT, PAGE_READWRITE);
+    if (ptr)
+      return ptr;
+  }
 
-  if (size > pool->chunk_size) {
-    return NULL;
+  return NULL;
+#else
+#if defined(MAP_HUGETLB)
+  if (pages->flags & PAGE_ALLOCATOR_HUGETLB) {
+    void* ptr = mmap(NULL, size, PROT_READ | PROT_WRITE,
+                     MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+    if (ptr != MAP_FAILED) {
+      if (pages->numa_node >= 0) {
+        alloc_bind_node(ptr, align_forward(size, pages->page_size),
+                        pages->numa_node);
+      }
+      return ptr;
+    }
   }
+#endif
 
-  if (!pool->free_list) {
-    return NULL;
+  if (pages->flags & PAGE_ALLOCATOR_TRANSPARENT_HUGE &&
+      size >= pages->huge_page_size && alignment < pages->huge_page_size) {
+    alignment = pages->huge_page_size;
   }
 
-  void* ptr = pool->free_list;
-  pool->free_list = (void**)*pool->free_list;
+  size_t extra = alignment > pages->page_size ? alignment : 0;
+  uint8_t* base = (uint8_t*)mmap(NULL, size + extra, PROT_READ | PROT_WRITE,
+                                 MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
 
-  return ptr;
-}
+  if ((void*)base == MAP_FAILED) {
+    return NULL;
+  }
 
-static void* pool_allocator_realloc(allocator* self, void* ptr, size_t old_size,
-                                    size_t new_size, size_t alignment) {
-  pool_allocator* pool = (pool_allocator*)self->ctx;
+  uint8_t* ptr = base;
 
-  if (new_size <= pool->chunk_size && old_size <= pool->chunk_size) {
-    return ptr;
+  if (extra) {
+    ptr = (uint8_t*)align_forward((uintptr_t)base, alignment);
+    if (ptr > base) {
+      munmap(base, (size_t)(ptr - base));
+    }
+    if (base + extra > ptr) {
+      munmap(ptr + size, (size_t)(base + extra - ptr));
+    }
   }
 
-  void* new_ptr = pool_allocator_alloc(self, new_size, alignment);
+#if defined(MADV_HUGEPAGE)
+  if (pages->flags & PAGE_ALLOCATOR_TRANSPARENT_HUGE) {
+    madvise(ptr, size, MADV_HUGEPAGE);
+  }
+#endif
 
-  if (new_ptr && ptr) {
-    memcpy(new_ptr, ptr, old_size < new_size ? old_size : new_size);
-    pool_allocator_free(self, ptr, old_size);
+  if (pages->numa_node >= 0) {
+    alloc_bind_node(ptr, align_forward(size, pages->page_size),
+                    pages->numa_node);
   }
 
-  return new_ptr;
+  return ptr;
+#endif
 }
 
-static void pool_allocator_free(allocator* self, void* ptr, size_t size) {
-  pool_allocator* pool = (pool_allocator*)self->ctx;
+static void page_allocator_unmap(void* ptr, size_t size) {
+#if defined(_WIN32)
   (void)size;
+  VirtualFree(ptr, 0, MEM_RELEASE);
+#else
+  munmap(ptr, size);
+#endif
+}
 
-  if (!ptr)
-    return;
+static void* page_allocator_alloc(allocator* self, size_t size,
+                                  size_t alignment) {
+  page_allocator* pages = (page_allocator*)self->ctx;
+
+  if (size == 0) {
+    return NULL;
+  }
+
+  return page_allocator_map(pages, page_allocator_round(pages, size),
+                            alignment);
+}
+
+static void page_allocator_free(allocator* self, void* ptr, size_t size);
+
+static void* page_allocator_realloc(allocator* self, void* ptr,
+                                    size_t old_size, size_t new_size,
+                                    size_t alignment) {
+  page_allocator* pages = (page_allocator*)self->ctx;
+
+  if (!ptr) {
+    return page_allocator_alloc(self, new_size, alignment);
+  }
+
+  size_t old_rounded = page_allocator_round(pages, old_size);
+  size_t new_rounded = page_allocator_round(pages, new_size);
+
+  if (new_rounded == old_rounded) {
+    return ptr;
+  }
+
+#if !defined(_WIN32)
+  if (new_rounded < old_rounded) {
+    munmap((uint8_t*)ptr + new_rounded, old_rounded - new_rounded);
+    return ptr;
+  }
+#endif
+
+#if defined(__linux__) && defined(MREMAP_MAYMOVE)
+  void* moved = mremap(ptr, old_rounded, new_rounded,
+                       alignment <= pages->page_size ? MREMAP_MAYMOVE : 0);
+  if (moved != MAP_FAILED) {
+    return moved;
+  }
+#endif
+
+  void* new_ptr = page_allocator_map(pages, new_rounded, alignment);
+
+  if (new_ptr) {
+    memcpy(new_ptr, ptr, old_size < new_size ? old_size : new_size);
+    page_allocator_free(self, ptr, old_size);
+  }
+
+  return new_ptr;
+}
+
+static void page_allocator_free(allocator* self, void* ptr, size_t size) {
+  page_allocator* pages = (page_allocator*)self->ctx;
+
+  if (!ptr)
+    return;
+
+  page_allocator_unmap(ptr, page_allocator_round(pages, size));
+}
+
+static void page_allocator_init(page_allocator* pages, int flags) {
+#if defined(_WIN32)
+  SYSTEM_INFO info;
+  GetSystemInfo(&info);
+  pages->page_size = info.dwAllocationGranularity;
+  pages->huge_page_size = GetLargePageMinimum();
+  if (pages->huge_page_size == 0) {
+    pages->huge_page_size = (size_t)2 << 20;
+  }
+#else
+  pages->page_size = (size_t)sysconf(_SC_PAGESIZE);
+  pages->huge_page_size = (size_t)2 << 20;
+#endif
+  pages->flags = flags;
+  pages->numa_node = -1;
+}
+
+static allocator page_allocator_get(page_allocator* pages) {
+  allocator alloc = {.alloc = page_allocator_alloc,
+                     .realloc = page_allocator_realloc,
+                     .free = page_allocator_free,
+                     .ctx = pages};
+  return alloc;
+}
+
+typedef struct arena_block arena_block;
+
+struct arena_block {
+  arena_block* prev;
+  size_t size;
+};
+
+typedef struct arena_allocator {
+  uint8_t* buffer;
+  size_t buffer_size;
+  size_t offset;
+  allocator* backing;
+  arena_block* blocks;
+  size_t block_size;
+  size_t max_block_size;
+  int keep_largest;
+  size_t peak;
+  arena_block* spare;
+  size_t dirty;
+  int zero_on_reset;
+} arena_allocator;
+
+typedef struct arena_marker {
+  arena_block* block;
+  size_t offset;
+} arena_marker;
+
+static size_t arena_allocator_aligned_offset(arena_allocator* arena,
+                                             size_t alignment) {
+  uintptr_t addr = (uintptr_t)(arena->buffer + arena->offset);
+  return arena->offset + (align_forward(addr, alignment) - addr);
+}
+
+static int arena_allocator_grow(arena_allocator* arena, size_t size,
+                                size_t alignment) {
+  if (!arena->backing) {
+    return 0;
+  }
+
+  arena_block** spare = &arena->spare;
+  while (*spare && (*spare)->size < size + alignment) {
+    spare = &(*spare)->prev;
+  }
+
+  arena_block* block = *spare;
+
+  if (block) {
+    *spare = block->prev;
+    block->prev = arena->blocks;
+    arena->blocks = block;
+    arena->buffer = (uint8_t*)(block + 1);
+    arena->buffer_size = block->size;
+    arena->offset = 0;
+    arena->dirty = block->size;
+    return 1;
+  }
+
+  size_t block_size = arena->block_size;
+  if (block_size < size + alignment) {
+    block_size = size + alignment;
+  }
+
+  if (arena->zero_on_reset) {
+    block = (arena_block*)alloc_alloc_zeroed(
+        arena->backing, sizeof(arena_block) + block_size, sizeof(void*));
+  } else {
+    block = (arena_block*)alloc_alloc(
+        arena->backing, sizeof(arena_block) + block_size, sizeof(void*));
+  }
+
+  if (!block) {
+    return 0;
+  }
+
+  block->prev = arena->blocks;
+  block->size = block_size;
+  arena->blocks = block;
+  arena->buffer = (uint8_t*)(block + 1);
+  arena->buffer_size = block_size;
+  arena->offset = 0;
+  arena->dirty = arena->zero_on_reset ? 0 : block_size;
+  ALLOC_ASAN_POISON(arena->buffer, block_size);
+
+  if (arena->block_size < arena->max_block_size) {
+    arena->block_size = arena->block_size * 2 < arena->max_block_size
+                            ? arena->block_size * 2
+                            : arena->max_block_size;
+  }
+
+  return 1;
+}
+
+static void* arena_allocator_alloc(allocator* self, size_t size,
+                                   size_t alignment) {
+  arena_allocator* arena = (arena_allocator*)self->ctx;
+
+  size_t aligned_offset = arena_allocator_aligned_offset(arena, alignment);
+
+  if (aligned_offset + size > arena->buffer_size) {
+    if (!arena_allocator_grow(arena, size, alignment)) {
+      return NULL;
+    }
+
+    aligned_offset = arena_allocator_aligned_offset(arena, alignment);
+  }
+
+  void* ptr = arena->buffer + aligned_offset;
+  arena->offset = aligned_offset + size;
+  ALLOC_ASAN_UNPOISON(ptr, size);
+
+  if (arena->offset > arena->peak) {
+    arena->peak = arena->offset;
+  }
+
+  return ptr;
+}
+
+static void* arena_allocator_alloc_zeroed(allocator* self, size_t size,
+                                          size_t alignment) {
+  arena_allocator* arena = (arena_allocator*)self->ctx;
+  uint8_t* ptr = (uint8_t*)arena_allocator_alloc(self, size, alignment);
+
+  /* Bytes past max(offset, dirty) are still zero from the last bulk clear or
+   * from the backing allocator, so only the dirty prefix needs clearing. */
+  if (ptr) {
+    size_t start = (size_t)(ptr - arena->buffer);
+    if (start < arena->dirty) {
+      alloc_zero_memory(
+          ptr, arena->dirty - start < size ? arena->dirty - start : size);
+    }
+  }
+
+  return ptr;
+}
+
+static size_t arena_allocator_alloc_batch(allocator* self, size_t size,
+                                          size_t alignment, void** out,
+                                          size_t count) {
+  arena_allocator* arena = (arena_allocator*)self->ctx;
+
+  if (count == 0) {
+    return 0;
+  }
+
+  size_t stride = align_forward(size, alignment);
+  size_t total = stride * (count - 1) + size;
+  size_t aligned_offset = arena_allocator_aligned_offset(arena, alignment);
+
+  if (aligned_offset + total > arena->buffer_size) {
+    if (arena_allocator_grow(arena, total, alignment)) {
+      aligned_offset = arena_allocator_aligned_offset(arena, alignment);
+    } else if (aligned_offset + size > arena->buffer_size) {
+      return 0;
+    } else {
+      count = (arena->buffer_size - aligned_offset - size) / stride + 1;
+    }
+  }
+
+  uint8_t* ptr = arena->buffer + aligned_offset;
+  for (size_t i = 0; i < count; i++) {
+    out[i] = ptr + i * stride;
+  }
+
+  arena->offset = aligned_offset + stride * (count - 1) + size;
+  ALLOC_ASAN_UNPOISON(ptr, stride * (count - 1) + size);
+
+  if (arena->offset > arena->peak) {
+    arena->peak = arena->offset;
+  }
+
+  return count;
+}
+
+static void* arena_allocator_realloc(allocator* self, void* ptr,
+                                     size_t old_size, size_t new_size,
+                                     size_t alignment) {
+  arena_allocator* arena = (arena_allocator*)self->ctx;
+
+  if (!ptr) {
+    return arena_allocator_alloc(self, new_size, alignment);
+  }
+
+  uint8_t* byte_ptr = (uint8_t*)ptr;
+
+  if (byte_ptr + old_size == arena->buffer + arena->offset &&
+      ((uintptr_t)byte_ptr & (alignment - 1)) == 0) {
+    size_t offset = (size_t)(byte_ptr - arena->buffer);
+    if (offset + new_size <= arena->buffer_size) {
+      if (arena->offset > arena->dirty) {
+        arena->dirty = arena->offset;
+      }
+      arena->offset = offset + new_size;
+      ALLOC_ASAN_UNPOISON(ptr, new_size);
+      if (arena->offset > arena->peak) {
+        arena->peak = arena->offset;
+      }
+      return ptr;
+    }
+  }
+
+  void* new_ptr = arena_allocator_alloc(self, new_size, alignment);
+  if (new_ptr && ptr) {
+    memcpy(new_ptr, ptr, old_size < new_size ? old_size : new_size);
+  }
+
+  return new_ptr;
+}
+
+static void arena_allocator_free(allocator* self, void* ptr, size_t size) {
+  (void)self;
+  (void)ptr;
+  (void)size;
+  ALLOC_ASAN_POISON(ptr, size);
+}
+
+static void arena_allocator_reset(arena_allocator* arena) {
+  arena_block* current = arena->blocks;
+  arena_block* keep = NULL;
+  size_t dirty = arena->offset > arena->dirty ? arena->offset : arena->dirty;
+
+  while (arena->spare) {
+    arena_block* spare = arena->spare;
+    arena->spare = spare->prev;
+    spare->prev = arena->blocks;
+    arena->blocks = spare;
+  }
+
+  for (arena_block* block = arena->blocks; block; block = block->prev) {
+    if (!keep || !arena->keep_largest || block->size > keep->size) {
+      keep = block;
+    }
+  }
+
+  arena_block* block = arena->blocks;
+  while (block) {
+    arena_block* prev = block->prev;
+    if (block != keep) {
+      ALLOC_ASAN_UNPOISON(block + 1, block->size);
+      alloc_free(arena->backing, block, sizeof(arena_block) + block->size);
+    }
+    block = prev;
+  }
+
+  if (keep) {
+    keep->prev = NULL;
+    arena->blocks = keep;
+    arena->buffer = (uint8_t*)(keep + 1);
+    arena->buffer_size = keep->size;
+    if (keep != current) {
+      dirty = keep->size;
+    }
+  }
+
+  if (dirty > arena->buffer_size) {
+    dirty = arena->buffer_size;
+  }
+
+  if (arena->zero_on_reset && dirty) {
+    ALLOC_ASAN_UNPOISON(arena->buffer, dirty);
+    alloc_zero_memory(arena->buffer, dirty);
+    dirty = 0;
+  }
+
+  arena->offset = 0;
+  arena->dirty = dirty;
+  ALLOC_ASAN_POISON(arena->buffer, arena->buffer_size);
+}
+
+static void arena_allocator_init(arena_allocator* arena, void* buffer,
+                                 size_t size) {
+  arena->buffer = (uint8_t*)buffer;
+  arena->buffer_size = size;
+  arena->offset = 0;
+  arena->backing = NULL;
+  arena->blocks = NULL;
+  arena->block_size = 0;
+  arena->max_block_size = 0;
+  arena->keep_largest = 0;
+  arena->peak = 0;
+  arena->spare = NULL;
+  arena->dirty = size;
+  arena->zero_on_reset = 0;
+  ALLOC_ASAN_POISON(buffer, size);
+}
+
+/* With zero_on_reset, reset clears the used prefix in one bulk pass and new
+ * blocks come zeroed from the backing allocator, so zeroed allocations made
+ * after the reset skip their memset. */
+static void arena_allocator_set_zero_on_reset(arena_allocator* arena,
+                                              int enabled) {
+  arena->zero_on_reset = enabled;
+}
+
+static void arena_allocator_init_growable(arena_allocator* arena,
+                                          allocator* backing,
+                                          size_t block_size,
+                                          size_t max_block_size) {
+  arena_allocator_init(arena, NULL, 0);
+  arena->backing = backing;
+  arena->block_size = block_size;
+  arena->max_block_size =
+      max_block_size < block_size ? block_size : max_block_size;
+}
+
+static void arena_allocator_destroy(arena_allocator* arena) {
+  arena_block* lists[2] = {arena->blocks, arena->spare};
+
+  for (int i = 0; i < 2; i++) {
+    arena_block* block = lists[i];
+    while (block) {
+      arena_block* prev = block->prev;
+      ALLOC_ASAN_UNPOISON(block + 1, block->size);
+      alloc_free(arena->backing, block, sizeof(arena_block) + block->size);
+      block = prev;
+    }
+  }
+
+  if (!arena->backing) {
+    ALLOC_ASAN_UNPOISON(arena->buffer, arena->buffer_size);
+  }
+
+  arena->blocks = NULL;
+  arena->spare = NULL;
+  arena->buffer = NULL;
+  arena->buffer_size = 0;
+  arena->offset = 0;
+}
+
+static arena_marker arena_allocator_mark(arena_allocator* arena) {
+  arena_marker marker = {.block = arena->blocks, .offset = arena->offset};
+  return marker;
+}
+
+static void arena_allocator_restore(arena_allocator* arena,
+                                    arena_marker marker) {
+  int same_block = arena->blocks == marker.block;
+
+  if (same_block && arena->offset > arena->dirty) {
+    arena->dirty = arena->offset;
+  }
+
+  while (arena->blocks != marker.block) {
+    arena_block* block = arena->blocks;
+    arena->blocks = block->prev;
+    block->prev = arena->spare;
+    arena->spare = block;
+    ALLOC_ASAN_POISON(block + 1, block->size);
+  }
+
+  if (arena->blocks) {
+    arena->buffer = (uint8_t*)(arena->blocks + 1);
+    arena->buffer_size = arena->blocks->size;
+  } else if (arena->backing) {
+    arena->buffer = NULL;
+    arena->buffer_size = 0;
+  }
+
+  arena->offset = marker.offset;
+  if (!same_block) {
+    arena->dirty = arena->buffer_size;
+  }
+
+  if (arena->buffer) {
+    ALLOC_ASAN_POISON(arena->buffer + arena->offset,
+                      arena->buffer_size - arena->offset);
+  }
+}
+
+static allocator arena_allocator_get(arena_allocator* arena) {
+  allocator alloc = {.alloc = arena_allocator_alloc,
+                     .realloc = arena_allocator_realloc,
+                     .free = arena_allocator_free,
+                     .ctx = arena,
+                     .alloc_batch = arena_allocator_alloc_batch,
+                     .alloc_zeroed = arena_allocator_alloc_zeroed};
+  return alloc;
+}
+
+#ifndef TEMP_ARENA_BLOCK_SIZE
+#define TEMP_ARENA_BLOCK_SIZE ((size_t)64 * 1024)
+#endif
+
+#ifndef TEMP_ARENA_MAX_BLOCK_SIZE
+#define TEMP_ARENA_MAX_BLOCK_SIZE ((size_t)64 * 1024 * 1024)
+#endif
+
+typedef struct temp_arena {
+  arena_allocator* arena;
+  arena_marker marker;
+} temp_arena;
+
+static ALLOC_THREAD_LOCAL arena_allocator temp_arenas[2];
+static ALLOC_THREAD_LOCAL int temp_arenas_ready;
+static alloc_tls_key temp_arena_key;
+static alloc_once temp_arena_once = ALLOC_ONCE_INIT;
+
+static void temp_thread_release(void) {
+  if (!temp_arenas_ready) {
+    return;
+  }
+
+  arena_allocator_destroy(&temp_arenas[0]);
+  arena_allocator_destroy(&temp_arenas[1]);
+  temp_arenas_ready = 0;
+}
+
+static void temp_arena_thread_exit(void* value) {
+  (void)value;
+  temp_thread_release();
+}
+
+static void temp_arena_create_key(void) {
+  alloc_tls_create(&temp_arena_key, temp_arena_thread_exit);
+}
+
+static temp_arena temp_begin(arena_allocator* conflict) {
+  if (!temp_arenas_ready) {
+    for (int i = 0; i < 2; i++) {
+      arena_allocator_init_growable(&temp_arenas[i], c_allocator(),
+                                    TEMP_ARENA_BLOCK_SIZE,
+                                    TEMP_ARENA_MAX_BLOCK_SIZE);
+    }
+
+    alloc_call_once(&temp_arena_once, temp_arena_create_key);
+    alloc_tls_set(temp_arena_key, temp_arenas);
+    temp_arenas_ready = 1;
+  }
+
+  arena_allocator* arena =
+      conflict == &temp_arenas[0] ? &temp_arenas[1] : &temp_arenas[0];
+  temp_arena temp = {.arena = arena, .marker = arena_allocator_mark(arena)};
+
+  return temp;
+}
+
+static void temp_end(temp_arena temp) {
+  arena_allocator_restore(temp.arena, temp.marker);
+}
+
+typedef struct virtual_arena_allocator {
+  uint8_t* base;
+  size_t reserved;
+  size_t committed;
+  size_t offset;
+  size_t page_size;
+  size_t commit_granularity;
+  size_t decommit_threshold;
+  size_t peak;
+  size_t dirty;
+} virtual_arena_allocator;
+
+static int virtual_arena_allocator_commit(virtual_arena_allocator* arena,
+                                          size_t end) {
+  if (end <= arena->committed) {
+    return 1;
+  }
+
+  if (end > arena->reserved) {
+    return 0;
+  }
+
+  size_t target = align_forward(end, arena->commit_granularity);
+  if (target > arena->reserved) {
+    target = arena->reserved;
+  }
+
+  uint8_t* start = arena->base + arena->committed;
+  size_t length = target - arena->committed;
+
+#if defined(_WIN32)
+  if (!VirtualAlloc(start, length, MEM_COMMIT, PAGE_READWRITE)) {
+    return 0;
+  }
+#else
+  if (mprotect(start, length, PROT_READ | PROT_WRITE) != 0) {
+    return 0;
+  }
+#endif
+
+  arena->committed = target;
+  return 1;
+}
+
+static void virtual_arena_allocator_decommit(virtual_arena_allocator* arena,
+                                             size_t keep) {
+  keep = align_forward(keep, arena->page_size);
+
+  if (keep >= arena->committed) {
+    return;
+  }
+
+  uint8_t* start = arena->base + keep;
+  size_t length = arena->committed - keep;
+
+#if defined(_WIN32)
+  VirtualFree(start, length, MEM_DECOMMIT);
+#elif defined(MADV_DONTNEED)
+  madvise(start, length, MADV_DONTNEED);
+  mprotect(start, length, PROT_NONE);
+#else
+  mmap(start, length, PROT_NONE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_FIXED, -1,
+       0);
+#endif
+
+  arena->committed = keep;
+  if (arena->dirty > keep) {
+    arena->dirty = keep;
+  }
+}
+
+static void* virtual_arena_allocator_alloc(allocator* self, size_t size,
+                                           size_t alignment) {
+  virtual_arena_allocator* arena = (virtual_arena_allocator*)self->ctx;
+
+  uintptr_t addr = (uintptr_t)(arena->base + arena->offset);
+  size_t aligned_offset =
+      arena->offset + (align_forward(addr, alignment) - addr);
+
+  if (aligned_offset + size < aligned_offset ||
+      !virtual_arena_allocator_commit(arena, aligned_offset + size)) {
+    return NULL;
+  }
+
+  arena->offset = aligned_offset + size;
+
+  if (arena->offset > arena->peak) {
+    arena->peak = arena->offset;
+  }
+
+  return arena->base + aligned_offset;
+}
+
+static void* virtual_arena_allocator_realloc(allocator* self, void* ptr,
+                                             size_t old_size, size_t new_size,
+                                             size_t alignment) {
+  virtual_arena_allocator* arena = (virtual_arena_allocator*)self->ctx;
+
+  if (!ptr) {
+    return virtual_arena_allocator_alloc(self, new_size, alignment);
+  }
+
+  uint8_t* byte_ptr = (uint8_t*)ptr;
+
+  if (byte_ptr + old_size == arena->base + arena->offset) {
+    size_t offset = (size_t)(byte_ptr - arena->base);
+
+    if (!virtual_arena_allocator_commit(arena, offset + new_size)) {
+      return NULL;
+    }
+
+    if (arena->offset > arena->dirty) {
+      arena->dirty = arena->offset;
+    }
+    arena->offset = offset + new_size;
+    if (arena->offset > arena->peak) {
+      arena->peak = arena->offset;
+    }
+    return ptr;
+  }
+
+  void* new_ptr = virtual_arena_allocator_alloc(self, new_size, alignment);
+
+  if (new_ptr) {
+    memcpy(new_ptr, ptr, old_size < new_size ? old_size : new_size);
+  }
+
+  return new_ptr;
+}
+
+/* Freshly committed pages are zero-filled by the OS, so only bytes below the
+ * dirty high-water mark need clearing. */
+static void* virtual_arena_allocator_alloc_zeroed(allocator* self, size_t size,
+                                                  size_t alignment) {
+  virtual_arena_allocator* arena = (virtual_arena_allocator*)self->ctx;
+  uint8_t* ptr = (uint8_t*)virtual_arena_allocator_alloc(self, size, alignment);
+
+  if (ptr) {
+    size_t start = (size_t)(ptr - arena->base);
+    if (start < arena->dirty) {
+      alloc_zero_memory(
+          ptr, arena->dirty - start < size ? arena->dirty - start : size);
+    }
+  }
+
+  return ptr;
+}
+
+static void virtual_arena_allocator_free(allocator* self, void* ptr,
+                                         size_t size) {
+  (void)self;
+  (void)ptr;
+  (void)size;
+}
+
+static int virtual_arena_allocator_init(virtual_arena_allocator* arena,
+                                        size_t reserve_size) {
+#if defined(_WIN32)
+  SYSTEM_INFO info;
+  GetSystemInfo(&info);
+  arena->page_size = info.dwPageSize;
+#else
+  arena->page_size = (size_t)sysconf(_SC_PAGESIZE);
+#endif
+  arena->reserved = align_forward(reserve_size, arena->page_size);
+  arena->committed = 0;
+  arena->offset = 0;
+  arena->commit_granularity = arena->page_size * 16;
+  arena->decommit_threshold = arena->commit_granularity * 16;
+  arena->peak = 0;
+  arena->dirty = 0;
+
+#if defined(_WIN32)
+  arena->base =
+      (uint8_t*)VirtualAlloc(NULL, arena->reserved, MEM_RESERVE, PAGE_NOACCESS);
+#else
+  int map_flags = MAP_PRIVATE | MAP_ANONYMOUS;
+#if defined(MAP_NORESERVE)
+  map_flags |= MAP_NORESERVE;
+#endif
+  void* base = mmap(NULL, arena->reserved, PROT_NONE, map_flags, -1, 0);
+  arena->base = base == MAP_FAILED ? NULL : (uint8_t*)base;
+#endif
+
+  if (!arena->base) {
+    arena->reserved = 0;
+    return 0;
+  }
+
+  return 1;
+}
+
+static void virtual_arena_allocator_reset(virtual_arena_allocator* arena) {
+  if (arena->offset > arena->dirty) {
+    arena->dirty = arena->offset;
+  }
+  arena->offset = 0;
+
+  if (arena->committed > arena->decommit_threshold) {
+    virtual_arena_allocator_decommit(arena, arena->decommit_threshold);
+  }
+}
+
+static void virtual_arena_allocator_destroy(virtual_arena_allocator* arena) {
+  if (arena->base) {
+#if defined(_WIN32)
+    VirtualFree(arena->base, 0, MEM_RELEASE);
+#else
+    munmap(arena->base, arena->reserved);
+#endif
+  }
+
+  arena->base = NULL;
+  arena->reserved = 0;
+  arena->committed = 0;
+  arena->offset = 0;
+  arena->dirty = 0;
+}
+
+static allocator virtual_arena_allocator_get(virtual_arena_allocator* arena) {
+  allocator alloc = {.alloc = virtual_arena_allocator_alloc,
+                     .realloc = virtual_arena_allocator_realloc,
+                     .free = virtual_arena_allocator_free,
+                     .ctx = arena,
+                     .alloc_zeroed = virtual_arena_allocator_alloc_zeroed};
+  return alloc;
+}
+
+#define PERSISTENT_ARENA_MAGIC 0x414e455241504c41ULL
+#define PERSISTENT_ARENA_VERSION 1
+#define PERSISTENT_ARENA_HEADER_SIZE ((size_t)4096)
+
+#define PERSISTENT_ARENA_FAILED 0
+#define PERSISTENT_ARENA_CREATED 1
+#define PERSISTENT_ARENA_LOADED 2
+#define PERSISTENT_ARENA_MISMATCH 3
+
+#define PERSISTENT_ARENA_VERIFY 1
+#define PERSISTENT_ARENA_REINIT 2
+
+typedef struct persistent_arena_header {
+  uint64_t magic;
+  uint32_t version;
+  uint32_t user_version;
+  uint64_t capacity;
+  uint64_t offset;
+  uint64_t root;
+  uint64_t base;
+  uint64_t checksum;
+} persistent_arena_header;
+
+typedef struct persistent_arena {
+  arena_allocator arena;
+  persistent_arena_header* header;
+  size_t size;
+  int relocated;
+#if defined(_WIN32)
+  HANDLE file;
+  HANDLE mapping;
+#else
+  int fd;
+#endif
+} persistent_arena;
+
+/* Word-at-a-time FNV variant; the persisted image can be gigabytes, so the
+ * check has to run far faster than a byte-wise hash. */
+static uint64_t persistent_arena_checksum(const void* data, size_t size) {
+  const uint8_t* bytes = (const uint8_t*)data;
+  uint64_t hash = 0xcbf29ce484222325ULL ^ size;
+
+  for (; size >= 8; size -= 8, bytes += 8) {
+    uint64_t word;
+    memcpy(&word, bytes, sizeof(word));
+    hash = (hash ^ word) * 0x100000001b3ULL;
+    hash ^= hash >> 29;
+  }
+
+  while (size--) {
+    hash = (hash ^ *bytes++) * 0x100000001b3ULL;
+  }
+
+  return hash;
+}
+
+static int persistent_arena_valid(persistent_arena_header* header,
+                                  size_t file_size, uint32_t user_version,
+                                  int verify) {
+  if (file_size < PERSISTENT_ARENA_HEADER_SIZE ||
+      header->magic != PERSISTENT_ARENA_MAGIC ||
+      header->version != PERSISTENT_ARENA_VERSION ||
+      header->user_version != user_version ||
+      header->capacity != file_size ||
+      header->offset > file_size - PERSISTENT_ARENA_HEADER_SIZE ||
+      (header->root && (header->root < PERSISTENT_ARENA_HEADER_SIZE ||
+                        header->root >=
+                            PERSISTENT_ARENA_HEADER_SIZE + header->offset))) {
+    return 0;
+  }
+
+  return !verify ||
+         header->checksum ==
+             persistent_arena_checksum(
+                 (uint8_t*)header + PERSISTENT_ARENA_HEADER_SIZE,
+                 header->offset);
+}
+
+static void persistent_arena_unmap(persistent_arena* pa) {
+#if defined(_WIN32)
+  if (pa->header) {
+    UnmapViewOfFile(pa->header);
+  }
+  if (pa->mapping) {
+    CloseHandle(pa->mapping);
+  }
+  if (pa->file != INVALID_HANDLE_VALUE) {
+    CloseHandle(pa->file);
+  }
+#else
+  if (pa->header) {
+    munmap(pa->header, pa->size);
+  }
+  if (pa->fd >= 0) {
+    close(pa->fd);
+  }
+#endif
+
+  memset(pa, 0, sizeof(*pa));
+#if defined(_WIN32)
+  pa->file = INVALID_HANDLE_VALUE;
+#else
+  pa->fd = -1;
+#endif
+}
+
+/* Maps the file at path, creating or extending it to capacity bytes. A file
+ * whose header and user_version match is loaded as it was last committed;
+ * PERSISTENT_ARENA_VERIFY also checks the data against its checksum. Any
+ * other non-empty file is left as found and reported as a mismatch unless
+ * PERSISTENT_ARENA_REINIT asks for it to be reinitialized empty. address is
+ * a placement hint: when the mapping lands away from where the file was
+ * created, relocated is set and only offsets and alloc_relptr fields remain
+ * valid. */
+static int persistent_arena_open(persistent_arena* pa, const char* path,
+                                 size_t capacity, uint32_t user_version,
+                                 void* address, int flags) {
+  memset(pa, 0, sizeof(*pa));
+  size_t size = align_forward(capacity, PERSISTENT_ARENA_HEADER_SIZE);
+  size_t file_size;
+
+  if (size < 2 * PERSISTENT_ARENA_HEADER_SIZE) {
+    size = 2 * PERSISTENT_ARENA_HEADER_SIZE;
+  }
+
+#if defined(_WIN32)
+  pa->file = CreateFileA(path, GENERIC_READ | GENERIC_WRITE, 0, NULL,
+                         OPEN_ALWAYS, FILE_ATTRIBUTE_NORMAL, NULL);
+  LARGE_INTEGER length;
+
+  if (pa->file == INVALID_HANDLE_VALUE || !GetFileSizeEx(pa->file, &length)) {
+    persistent_arena_unmap(pa);
+    return PERSISTENT_ARENA_FAILED;
+  }
+
+  file_size = (size_t)length.QuadPart;
+  if (file_size > size) {
+    size = file_size;
+  }
+
+  length.QuadPart = (LONGLONG)size;
+  pa->mapping = CreateFileMappingA(pa->file, NULL, PAGE_READWRITE,
+                                   (DWORD)(length.QuadPart >> 32),
+                                   (DWORD)length.QuadPart, NULL);
+  void* base = pa->mapping ? MapViewOfFileEx(pa->mapping, FILE_MAP_WRITE, 0,
+                                             0, size, address)
+                           : NULL;
+  if (!base && pa->mapping && address) {
+    base = MapViewOfFileEx(pa->mapping, FILE_MAP_WRITE, 0, 0, size, NULL);
+  }
+#else
+  pa->fd = open(path, O_RDWR | O_CREAT, 0644);
+  struct stat st;
+
+  if (pa->fd < 0 || fstat(pa->fd, &st) != 0) {
+    persistent_arena_unmap(pa);
+    return PERSISTENT_ARENA_FAILED;
+  }
+
+  file_size = (size_t)st.st_size;
+  if (file_size > size) {
+    size = file_size;
+  }
+
+  void* base = NULL;
+  if (file_size == size || ftruncate(pa->fd, (off_t)size) == 0) {
+    base = mmap(address, size, PROT_READ | PROT_WRITE, MAP_SHARED, pa->fd, 0);
+    base = base == MAP_FAILED ? NULL : base;
+  }
+#endif
+
+  if (!base) {
+    persistent_arena_unmap(pa);
+    return PERSISTENT_ARENA_FAILED;
+  }
+
+  persistent_arena_header* header = (persistent_arena_header*)base;
+  int loaded = persistent_arena_valid(header, file_size, user_version,
+                                      flags & PERSISTENT_ARENA_VERIFY);
+
+  pa->header = header;
+  pa->size = size;
+
+  if (!loaded && file_size != 0 && !(flags & PERSISTENT_ARENA_REINIT)) {
+    /* Undo any extension so the caller finds the file as it was. */
+#if defined(_WIN32)
+    UnmapViewOfFile(base);
+    CloseHandle(pa->mapping);
+    pa->header = NULL;
+    pa->mapping = NULL;
+    length.QuadPart = (LONGLONG)file_size;
+    int restored = size == file_size ||
+                   (SetFilePointerEx(pa->file, length, NULL, FILE_BEGIN) &&
+                    SetEndOfFile(pa->file));
+#else
+    int restored =
+        size == file_size || ftruncate(pa->fd, (off_t)file_size) == 0;
+#endif
+    persistent_arena_unmap(pa);
+    return restored ? PERSISTENT_ARENA_MISMATCH : PERSISTENT_ARENA_FAILED;
+  }
+
+  arena_allocator_init(&pa->arena,
+                       (uint8_t*)base + PERSISTENT_ARENA_HEADER_SIZE,
+                       size - PERSISTENT_ARENA_HEADER_SIZE);
+
+  if (loaded) {
+    pa->relocated = header->base != (uint64_t)(uintptr_t)base;
+    pa->arena.offset = (size_t)header->offset;
+    pa->arena.peak = pa->arena.offset;
+    ALLOC_ASAN_UNPOISON(pa->arena.buffer, pa->arena.offset);
+  } else {
+    memset(header, 0, sizeof(*header));
+    header->magic = PERSISTENT_ARENA_MAGIC;
+    header->version = PERSISTENT_ARENA_VERSION;
+    header->user_version = user_version;
+    header->base = (uint64_t)(uintptr_t)base;
+    header->checksum = persistent_arena_checksum(NULL, 0);
+    if (file_size == 0) {
+      pa->arena.dirty = 0;
+    }
+  }
+
+  header->capacity = size;
+
+  return loaded ? PERSISTENT_ARENA_LOADED : PERSISTENT_ARENA_CREATED;
+}
+
+static inline uint64_t persistent_arena_offset(persistent_arena* pa,
+                                               const void* ptr) {
+  return ptr ? (uint64_t)((const uint8_t*)ptr - (uint8_t*)pa->header) : 0;
+}
+
+static inline void* persistent_arena_pointer(persistent_arena* pa,
+                                             uint64_t offset) {
+  return offset ? (uint8_t*)pa->header + offset : NULL;
+}
+
+static void persistent_arena_set_root(persistent_arena* pa, void* root) {
+  pa->header->root = persistent_arena_offset(pa, root);
+}
+
+static void* persistent_arena_root(persistent_arena* pa) {
+  return persistent_arena_pointer(pa, pa->header->root);
+}
+
+/* Flushes the data up to the high-water mark, then publishes it by writing
+ * the header. A crash before the header is flushed leaves the previous
+ * commit in place, or a checksum mismatch that PERSISTENT_ARENA_VERIFY
+ * reports on the next open. */
+static int persistent_arena_commit(persistent_arena* pa) {
+  persistent_arena_header* header = pa->header;
+  size_t used = pa->arena.offset;
+  int ok = 1;
+
+#if defined(_WIN32)
+  ok &= FlushViewOfFile(pa->arena.buffer, used) != 0;
+#else
+  ok &= used == 0 ||
+        msync(pa->arena.buffer,
+              align_forward(used, PERSISTENT_ARENA_HEADER_SIZE), MS_SYNC) == 0;
+#endif
+
+  header->offset = used;
+  header->checksum = persistent_arena_checksum(pa->arena.buffer, used);
+
+#if defined(_WIN32)
+  ok &= FlushViewOfFile(header, PERSISTENT_ARENA_HEADER_SIZE) != 0;
+  ok &= FlushFileBuffers(pa->file) != 0;
+#else
+  ok &= msync(header, PERSISTENT_ARENA_HEADER_SIZE, MS_SYNC) == 0;
+#endif
+
+  return ok;
+}
+
+static void persistent_arena_close(persistent_arena* pa) {
+  ALLOC_ASAN_UNPOISON(pa->arena.buffer, pa->arena.buffer_size);
+  persistent_arena_unmap(pa);
+}
+
+static allocator persistent_arena_get(persistent_arena* pa) {
+  return arena_allocator_get(&pa->arena);
+}
+
+/* Self-relative pointer: stores the distance from the field to its target,
+ * so linked structures stay valid wherever the mapping lands. */
+typedef int64_t alloc_relptr;
+
+static inline void alloc_relptr_set(alloc_relptr* rel, const void* target) {
+  *rel = target ? (int64_t)((intptr_t)target - (intptr_t)rel) : 0;
+}
+
+static inline void* alloc_relptr_get(const alloc_relptr* rel) {
+  return *rel ? (uint8_t*)rel + *rel : NULL;
+}
+
+typedef struct pool_block {
+  struct pool_block* next;
+  size_t free_chunks;
+} pool_block;
+
+typedef struct pool_allocator {
+  uint8_t* buffer;
+  size_t chunk_size;
+  size_t chunk_count;
+  void** free_list;
+  allocator* backing;
+  size_t chunk_stride;
+  size_t alignment;
+  size_t live_count;
+  size_t peak_count;
+  uint8_t* bump;
+  uint8_t* bump_end;
+  pool_block* blocks;
+  size_t block_size;
+  size_t block_chunks;
+  int numa_node;
+} pool_allocator;
+
+static void pool_allocator_free(allocator* self, void* ptr, size_t size);
+
+static inline uint8_t* pool_block_chunks(pool_allocator* pool,
+                                         pool_block* block) {
+  return (uint8_t*)align_forward((uintptr_t)(block + 1), pool->alignment);
+}
+
+static int pool_allocator_grow(pool_allocator* pool) {
+  if (!pool->backing) {
+    return 0;
+  }
+
+  pool_block* block = (pool_block*)alloc_alloc(pool->backing,
+                                               pool->block_size,
+                                               pool->block_size);
+
+  if (!block) {
+    return 0;
+  }
+
+  if (pool->numa_node >= 0) {
+    alloc_bind_node(block, pool->block_size, pool->numa_node);
+  }
+
+  block->next = pool->blocks;
+  block->free_chunks = 0;
+  pool->blocks = block;
+  pool->bump = pool_block_chunks(pool, block);
+  pool->bump_end = pool->bump + pool->block_chunks * pool->chunk_stride;
+  pool->chunk_count += pool->block_chunks;
+  ALLOC_ASAN_POISON(pool->bump, (size_t)(pool->bump_end - pool->bump));
+
+  return 1;
+}
+
+static inline int pool_allocator_exhausted(pool_allocator* pool) {
+  return !pool->free_list && pool->bump == pool->bump_end && !pool->backing;
+}
+
+static void* pool_allocator_alloc(allocator* self, size_t size,
+                                  size_t alignment) {
+  pool_allocator* pool = (pool_allocator*)self->ctx;
+
+  if (size > pool->chunk_size || alignment > pool->alignment) {
+    return NULL;
+  }
+
+  void* ptr = pool->free_list;
+
+  if (ptr) {
+    pool->free_list = (void**)*pool->free_list;
+  } else {
+    if (pool->bump == pool->bump_end && !pool_allocator_grow(pool)) {
+      return NULL;
+    }
+
+    ptr = pool->bump;
+    pool->bump += pool->chunk_stride;
+  }
+
+  ALLOC_ASAN_UNPOISON(ptr, pool->chunk_size);
+
+  if (++pool->live_count > pool->peak_count) {
+    pool->peak_count = pool->live_count;
+  }
+
+  return ptr;
+}
+
+static size_t pool_allocator_alloc_batch(allocator* self, size_t size,
+                                         size_t alignment, void** out,
+                                         size_t count) {
+  pool_allocator* pool = (pool_allocator*)self->ctx;
+
+  if (size > pool->chunk_size || alignment > pool->alignment) {
+    return 0;
+  }
+
+  size_t i = 0;
+  void** node = pool->free_list;
+
+  while (i < count && node) {
+    ALLOC_ASAN_UNPOISON(node, pool->chunk_size);
+    out[i++] = node;
+    node = (void**)*node;
+  }
+
+  pool->free_list = node;
+
+  while (i < count) {
+    if (pool->bump == pool->bump_end && !pool_allocator_grow(pool)) {
+      break;
+    }
+
+    ALLOC_ASAN_UNPOISON(pool->bump, pool->chunk_size);
+    out[i++] = pool->bump;
+    pool->bump += pool->chunk_stride;
+  }
+
+  pool->live_count += i;
+  if (pool->live_count > pool->peak_count) {
+    pool->peak_count = pool->live_count;
+  }
+
+  return i;
+}
+
+static void* pool_allocator_realloc(allocator* self, void* ptr, size_t old_size,
+                                    size_t new_size, size_t alignment) {
+  pool_allocator* pool = (pool_allocator*)self->ctx;
+
+  if (new_size <= pool->chunk_size && old_size <= pool->chunk_size) {
+    return ptr;
+  }
+
+  void* new_ptr = pool_allocator_alloc(self, new_size, alignment);
+
+  if (new_ptr && ptr) {
+    memcpy(new_ptr, ptr, old_size < new_size ? old_size : new_size);
+    pool_allocator_free(self, ptr, old_size);
+  }
+
+  return new_ptr;
+}
+
+static void pool_allocator_free(allocator* self, void* ptr, size_t size) {
+  pool_allocator* pool = (pool_allocator*)self->ctx;
+  (void)size;
+
+  if (!ptr)
+    return;
+
+  void** free_node = (void**)ptr;
+  *free_node = pool->free_list;
+  pool->free_list = free_node;
+  pool->live_count--;
+  ALLOC_ASAN_POISON(free_node + 1, pool->chunk_stride - sizeof(void*));
+}
+
+static void pool_allocator_free_batch(allocator* self, void** ptrs,
+                                      size_t size, size_t count) {
+  pool_allocator* pool = (pool_allocator*)self->ctx;
+  (void)size;
+
+  void** head = pool->free_list;
+
+  for (size_t i = count; i-- > 0;) {
+    if (!ptrs[i])
+      continue;
+
+    void** free_node = (void**)ptrs[i];
+    *free_node = head;
+    head = free_node;
+    pool->live_count--;
+    ALLOC_ASAN_POISON(free_node + 1, pool->chunk_stride - sizeof(void*));
+  }
+
+  pool->free_list = head;
+}
+
+static void pool_allocator_thread(pool_allocator* pool) {
+  pool->free_list = NULL;
+  pool->live_count = 0;
+  pool->peak_count = 0;
+  pool->bump = pool->buffer;
+  pool->bump_end = pool->buffer + pool->chunk_count * pool->chunk_stride;
+  pool->blocks = NULL;
+  pool->block_size = 0;
+  pool->block_chunks = 0;
+  pool->numa_node = -1;
+  ALLOC_ASAN_POISON(pool->bump, (size_t)(pool->bump_end - pool->bump));
+}
+
+static void pool_allocator_init(pool_allocator* pool, void* buffer,
+                                size_t chunk_size, size_t chunk_count) {
+  pool->buffer = (uint8_t*)buffer;
+  pool->chunk_size = chunk_size;
+  pool->chunk_count = chunk_count;
+  pool->backing = NULL;
+  pool->chunk_stride = chunk_size;
+  /* Plain pools leave alignment to the caller, who owns the buffer. */
+  pool->alignment = SIZE_MAX;
+
+  pool_allocator_thread(pool);
+}
+
+static size_t pool_allocator_buffer_size(size_t chunk_size,
+                                         size_t chunk_count,
+                                         size_t alignment) {
+  if (chunk_size < sizeof(void*)) {
+    chunk_size = sizeof(void*);
+  }
+
+  return align_forward(chunk_size, alignment) * chunk_count + alignment - 1;
+}
+
+static void pool_allocator_init_aligned(pool_allocator* pool, void* buffer,
+                                        size_t chunk_size, size_t chunk_count,
+                                        size_t alignment) {
+  if (alignment < sizeof(void*)) {
+    alignment = sizeof(void*);
+  }
+
+  pool->buffer = (uint8_t*)align_forward((uintptr_t)buffer, alignment);
+  pool->chunk_size = chunk_size;
+  pool->chunk_count = chunk_count;
+  pool->backing = NULL;
+  pool->chunk_stride = align_forward(
+      chunk_size < sizeof(void*) ? sizeof(void*) : chunk_size, alignment);
+  pool->alignment = alignment;
+
+  pool_allocator_thread(pool);
+}
+
+static void pool_allocator_init_growable(pool_allocator* pool,
+                                         allocator* backing, size_t chunk_size,
+                                         size_t block_chunks,
+                                         size_t alignment) {
+  if (alignment < sizeof(void*)) {
+    alignment = sizeof(void*);
+  }
+
+  pool->buffer = NULL;
+  pool->chunk_size = chunk_size;
+  pool->chunk_count = 0;
+  pool->chunk_stride = align_forward(
+      chunk_size < sizeof(void*) ? sizeof(void*) : chunk_size, alignment);
+  pool->alignment = alignment;
+
+  pool_allocator_thread(pool);
+  pool->backing = backing;
+
+  size_t needed = align_forward(sizeof(pool_block), alignment) +
+                  (block_chunks ? block_chunks : 1) * pool->chunk_stride;
+  size_t block_size = 1;
+  while (block_size < needed) {
+    block_size <<= 1;
+  }
+
+  pool->block_size = block_size;
+  pool->block_chunks =
+      (block_size - align_forward(sizeof(pool_block), alignment)) /
+      pool->chunk_stride;
+}
+
+static size_t pool_allocator_trim(pool_allocator* pool) {
+  if (!pool->blocks) {
+    return 0;
+  }
+
+  uintptr_t mask = ~(uintptr_t)(pool->block_size - 1);
+
+  for (pool_block* block = pool->blocks; block; block = block->next) {
+    block->free_chunks = 0;
+  }
+
+  for (void** node = pool->free_list; node; node = (void**)*node) {
+    ((pool_block*)((uintptr_t)node & mask))->free_chunks++;
+  }
+
+  pool_block* current =
+      pool->bump_end ? (pool_block*)((uintptr_t)(pool->bump_end - 1) & mask)
+                     : NULL;
+
+  for (pool_block* block = pool->blocks; block; block = block->next) {
+    size_t used = pool->block_chunks;
+    if (block == current) {
+      used = (size_t)(pool->bump - pool_block_chunks(pool, block)) /
+             pool->chunk_stride;
+    }
+    block->free_chunks = block->free_chunks == used ? SIZE_MAX : 0;
+  }
+
+  void** link = (void**)&pool->free_list;
+  while (*link) {
+    void** node = (void**)*link;
+    if (((pool_block*)((uintptr_t)node & mask))->free_chunks == SIZE_MAX) {
+      *link = *node;
+    } else {
+      link = node;
+    }
+  }
+
+  if (current && current->free_chunks == SIZE_MAX) {
+    pool->bump = NULL;
+    pool->bump_end = NULL;
+  }
+
+  size_t released = 0;
+  pool_block** prev = &pool->blocks;
+
+  while (*prev) {
+    pool_block* block = *prev;
+    if (block->free_chunks == SIZE_MAX) {
+      *prev = block->next;
+      ALLOC_ASAN_UNPOISON(block, pool->block_size);
+      alloc_free(pool->backing, block, pool->block_size);
+      pool->chunk_count -= pool->block_chunks;
+      released++;
+    } else {
+      prev = &block->next;
+    }
+  }
+
+  return released;
+}
+
+static void pool_allocator_destroy(pool_allocator* pool) {
+  while (pool->blocks) {
+    pool_block* block = pool->blocks;
+    pool->blocks = block->next;
+    ALLOC_ASAN_UNPOISON(block, pool->block_size);
+    alloc_free(pool->backing, block, pool->block_size);
+  }
+
+  pool->free_list = NULL;
+  pool->bump = NULL;
+  pool->bump_end = NULL;
+  pool->chunk_count = 0;
+}
+
+/* Binds the pool's pages to node. A growable pool binds the blocks it
+ * holds and every block it grows by later. Returns 0 if any range failed
+ * to bind, including one too small to contain a whole page. */
+static int pool_allocator_bind_node(pool_allocator* pool, int node) {
+  if (!pool->backing) {
+    return alloc_bind_node(pool->buffer,
+                           pool->chunk_stride * pool->chunk_count, node);
+  }
+
+  int ok = 1;
+  pool->numa_node = node;
+  for (pool_block* block = pool->blocks; block; block = block->next) {
+    ok &= alloc_bind_node(block, pool->block_size, node);
+  }
+
+  return ok;
+}
+
+static allocator pool_allocator_get(pool_allocator* pool) {
+  allocator alloc = {.alloc = pool_allocator_alloc,
+                     .realloc = pool_allocator_realloc,
+                     .free = pool_allocator_free,
+                     .ctx = pool,
+                     .alloc_batch = pool_allocator_alloc_batch,
+                     .free_batch = pool_allocator_free_batch};
+  return alloc;
+}
+
+#ifndef HANDLE_POOL_INDEX_BITS
+#define HANDLE_POOL_INDEX_BITS 20
+#endif
+
+#define HANDLE_POOL_MAX_OBJECTS ((size_t)1 << HANDLE_POOL_INDEX_BITS)
+#define HANDLE_POOL_INDEX_MASK ((uint32_t)(HANDLE_POOL_MAX_OBJECTS - 1))
+
+typedef uint32_t pool_handle;
+
+#define POOL_HANDLE_NULL ((pool_handle)0)
+
+typedef struct handle_pool {
+  allocator* backing;
+  uint8_t* objects;
+  uint32_t* indices;
+  uint32_t* dense_slots;
+  uint32_t* slot_dense;
+  uint32_t* generations;
+  uint32_t* free_slots;
+  size_t free_count;
+  size_t slot_count;
+  size_t count;
+  size_t capacity;
+  size_t object_size;
+  size_t object_stride;
+  size_t alignment;
+  void (*construct)(void* object);
+  void (*destruct)(void* object);
+} handle_pool;
+
+static inline pool_handle handle_pool_encode(uint32_t slot,
+                                             uint32_t generation) {
+  return (pool_handle)(generation << HANDLE_POOL_INDEX_BITS) | slot;
+}
+
+static inline uint32_t handle_pool_next_generation(uint32_t generation) {
+  uint32_t next = (generation + 1) & (UINT32_MAX >> HANDLE_POOL_INDEX_BITS);
+  return next ? next : 1;
+}
+
+static int handle_pool_grow(handle_pool* pool, size_t capacity) {
+  if (capacity > HANDLE_POOL_MAX_OBJECTS) {
+    capacity = HANDLE_POOL_MAX_OBJECTS;
+  }
+
+  if (capacity <= pool->capacity) {
+    return 0;
+  }
+
+  size_t old = pool->capacity;
+  uint32_t* indices = (uint32_t*)alloc_alloc(
+      pool->backing, 4 * capacity * sizeof(uint32_t), sizeof(uint32_t));
+
+  if (!indices) {
+    return 0;
+  }
+
+  uint8_t* objects = (uint8_t*)alloc_realloc(
+      pool->backing, pool->objects, old * pool->object_stride,
+      capacity * pool->object_stride, pool->alignment);
+
+  if (!objects) {
+    alloc_free(pool->backing, indices, 4 * capacity * sizeof(uint32_t));
+    return 0;
+  }
+
+  uint32_t** arrays[4] = {&pool->dense_slots, &pool->slot_dense,
+                          &pool->generations, &pool->free_slots};
+
+  for (int i = 0; i < 4; i++) {
+    if (old) {
+      memcpy(indices + i * capacity, *arrays[i], old * sizeof(uint32_t));
+    }
+    *arrays[i] = indices + i * capacity;
+  }
+
+  if (old) {
+    alloc_free(pool->backing, pool->indices, 4 * old * sizeof(uint32_t));
+  }
+
+  pool->objects = objects;
+  pool->indices = indices;
+  pool->capacity = capacity;
+  return 1;
+}
+
+static int handle_pool_init(handle_pool* pool, allocator* backing,
+                            size_t object_size, size_t alignment,
+                            size_t capacity) {
+  if (alignment < sizeof(void*)) {
+    alignment = sizeof(void*);
+  }
+
+  memset(pool, 0, sizeof(*pool));
+  pool->backing = backing;
+  pool->object_size = object_size;
+  pool->object_stride = align_forward(object_size ? object_size : 1, alignment);
+  pool->alignment = alignment;
+
+  return handle_pool_grow(pool, capacity ? capacity : 64);
+}
+
+static void handle_pool_destroy(handle_pool* pool) {
+  if (pool->destruct) {
+    for (size_t i = 0; i < pool->count; i++) {
+      pool->destruct(pool->objects + i * pool->object_stride);
+    }
+  }
+
+  alloc_free(pool->backing, pool->objects,
+             pool->capacity * pool->object_stride);
+  alloc_free(pool->backing, pool->indices,
+             4 * pool->capacity * sizeof(uint32_t));
+
+  memset(pool, 0, sizeof(*pool));
+}
+
+static void* handle_pool_create(handle_pool* pool, pool_handle* handle) {
+  uint32_t slot;
+
+  if (pool->free_count > 0) {
+    slot = pool->free_slots[--pool->free_count];
+  } else {
+    if (pool->slot_count == pool->capacity &&
+        !handle_pool_grow(pool, pool->capacity * 2)) {
+      *handle = POOL_HANDLE_NULL;
+      return NULL;
+    }
+
+    slot = (uint32_t)pool->slot_count++;
+    pool->generations[slot] = 1;
+  }
+
+  uint32_t dense = (uint32_t)pool->count++;
+  pool->dense_slots[dense] = slot;
+  pool->slot_dense[slot] = dense;
+
+  void* object = pool->objects + (size_t)dense * pool->object_stride;
+
+  if (pool->construct) {
+    pool->construct(object);
+  } else {
+    memset(object, 0, pool->object_size);
+  }
+
+  *handle = handle_pool_encode(slot, pool->generations[slot]);
+  return object;
+}
+
+static inline int handle_pool_valid(handle_pool* pool, pool_handle handle) {
+  uint32_t slot = handle & HANDLE_POOL_INDEX_MASK;
+
+  return slot < pool->slot_count &&
+         handle_pool_encode(slot, pool->generations[slot]) == handle;
+}
+
+static inline void* handle_pool_get(handle_pool* pool, pool_handle handle) {
+  if (!handle_pool_valid(pool, handle)) {
+    return NULL;
+  }
+
+  uint32_t dense = pool->slot_dense[handle & HANDLE_POOL_INDEX_MASK];
+  return pool->objects + (size_t)dense * pool->object_stride;
+}
+
+static int handle_pool_release(handle_pool* pool, pool_handle handle) {
+  if (!handle_pool_valid(pool, handle)) {
+    return 0;
+  }
+
+  uint32_t slot = handle & HANDLE_POOL_INDEX_MASK;
+  uint32_t dense = pool->slot_dense[slot];
+  uint32_t last = (uint32_t)(pool->count - 1);
+  uint8_t* object = pool->objects + (size_t)dense * pool->object_stride;
+
+  if (pool->destruct) {
+    pool->destruct(object);
+  }
+
+  if (dense != last) {
+    memcpy(object, pool->objects + (size_t)last * pool->object_stride,
+           pool->object_size);
+    uint32_t moved = pool->dense_slots[last];
+    pool->dense_slots[dense] = moved;
+    pool->slot_dense[moved] = dense;
+  }
+
+  pool->count--;
+  pool->generations[slot] =
+      handle_pool_next_generation(pool->generations[slot]);
+  pool->free_slots[pool->free_count++] = slot;
+
+  return 1;
+}
+
+static inline size_t handle_pool_count(handle_pool* pool) {
+  return pool->count;
+}
+
+static inline void* handle_pool_at(handle_pool* pool, size_t dense) {
+  return pool->objects + dense * pool->object_stride;
+}
+
+static inline pool_handle handle_pool_handle_at(handle_pool* pool,
+                                                size_t dense) {
+  uint32_t slot = pool->dense_slots[dense];
+  return handle_pool_encode(slot, pool->generations[slot]);
+}
+
+typedef struct stack_allocator {
+  uint8_t* buffer;
+  size_t buffer_size;
+  size_t offset;
+  allocator* backing;
+  size_t peak;
+} stack_allocator;
+
+typedef struct stack_marker {
+  size_t offset;
+} stack_marker;
+
+static void* stack_allocator_alloc(allocator* self, size_t size,
+                                   size_t alignment) {
+  stack_allocator* stack = (stack_allocator*)self->ctx;
+
+  size_t aligned_offset = align_forward(stack->offset, alignment);
+
+  if (aligned_offset + size > stack->buffer_size) {
+    return NULL;
+  }
+
+  void* ptr = stack->buffer + aligned_offset;
+  stack->offset = aligned_offset + size;
+  ALLOC_ASAN_UNPOISON(ptr, size);
+
+  if (stack->offset > stack->peak) {
+    stack->peak = stack->offset;
+  }
+
+  return ptr;
+}
+
+static void* stack_allocator_realloc(allocator* self, void* ptr,
+                                     size_t old_size, size_t new_size,
+                                     size_t alignment) {
+  stack_allocator* stack = (stack_allocator*)self->ctx;
+
+  if (!ptr) {
+    return stack_allocator_alloc(self, new_size, alignment);
+  }
+
+  uint8_t* byte_ptr = (uint8_t*)ptr;
+
+  if (byte_ptr + old_size == stack->buffer + stack->offset) {
+    size_t aligned_offset =
+        align_forward((size_t)(byte_ptr - stack->buffer), alignment);
+
+    if (aligned_offset + new_size <= stack->buffer_size) {
+      stack->offset = aligned_offset + new_size;
+      ALLOC_ASAN_UNPOISON(ptr, (size_t)(stack->buffer + stack->offset -
+                                        byte_ptr));
+      if (stack->offset > stack->peak) {
+        stack->peak = stack->offset;
+      }
+      return ptr;
+    }
+  }
+
+  void* new_ptr = stack_allocator_alloc(self, new_size, alignment);
+
+  if (new_ptr && ptr) {
+    memcpy(new_ptr, ptr, old_size < new_size ? old_size : new_size);
+  }
+
+  return new_ptr;
+}
+
+static void stack_allocator_free(allocator* self, void* ptr, size_t size) {
+  stack_allocator* stack = (stack_allocator*)self->ctx;
+
+  if (!ptr)
+    return;
+
+  uint8_t* byte_ptr = (uint8_t*)ptr;
+
+  if (byte_ptr + size == stack->buffer + stack->offset) {
+    stack->offset = (size_t)(byte_ptr - stack->buffer);
+    ALLOC_ASAN_POISON(ptr, size);
+  }
+}
+
+static void stack_allocator_init(stack_allocator* stack, void* buffer,
+                                 size_t size) {
+  stack->buffer = (uint8_t*)buffer;
+  stack->buffer_size = size;
+  stack->offset = 0;
+  stack->backing = NULL;
+  stack->peak = 0;
+  ALLOC_ASAN_POISON(buffer, size);
+}
+
+static stack_marker stack_allocator_mark(stack_allocator* stack) {
+  stack_marker marker = {.offset = stack->offset};
+  return marker;
+}
+
+static void stack_allocator_restore(stack_allocator* stack,
+                                    stack_marker marker) {
+  if (marker.offset < stack->offset) {
+    ALLOC_ASAN_POISON(stack->buffer + marker.offset,
+                      stack->offset - marker.offset);
+  }
+
+  stack->offset = marker.offset;
+}
+
+static void stack_allocator_reset(stack_allocator* stack) {
+  stack->offset = 0;
+  ALLOC_ASAN_POISON(stack->buffer, stack->buffer_size);
+}
+
+static allocator stack_allocator_get(stack_allocator* stack) {
+  allocator alloc = {.alloc = stack_allocator_alloc,
+                     .realloc = stack_allocator_realloc,
+                     .free = stack_allocator_free,
+                     .ctx = stack};
+  return alloc;
+}
+
+typedef struct double_stack_allocator {
+  uint8_t* buffer;
+  size_t buffer_size;
+  size_t front;
+  size_t back;
+  size_t peak;
+} double_stack_allocator;
+
+static void double_stack_allocator_track_peak(double_stack_allocator* stack) {
+  size_t used = stack->front + (stack->buffer_size - stack->back);
+
+  if (used > stack->peak) {
+    stack->peak = used;
+  }
+}
+
+static void* double_stack_allocator_alloc_front(allocator* self, size_t size,
+                                                size_t alignment) {
+  double_stack_allocator* stack = (double_stack_allocator*)self->ctx;
+
+  uintptr_t base = (uintptr_t)stack->buffer;
+  size_t aligned_offset =
+      (size_t)(align_forward(base + stack->front, alignment) - base);
+
+  if (aligned_offset > stack->back || size > stack->back - aligned_offset) {
+    return NULL;
+  }
+
+  stack->front = aligned_offset + size;
+  double_stack_allocator_track_peak(stack);
+
+  return stack->buffer + aligned_offset;
+}
+
+/* Back allocations carry a trailer holding the back offset from before the
+ * allocation, so a free also gives back the alignment padding. */
+static uint8_t* double_stack_allocator_place_back(
+    double_stack_allocator* stack, size_t previous, size_t size,
+    size_t alignment) {
+  if (previous - stack->front < sizeof(size_t) ||
+      size > previous - stack->front - sizeof(size_t)) {
+    return NULL;
+  }
+
+  uintptr_t base = (uintptr_t)stack->buffer;
+  uintptr_t address = (base + previous - sizeof(size_t) - size) &
+                      ~(uintptr_t)(alignment - 1);
+
+  return address < base + stack->front ? NULL : (uint8_t*)address;
+}
+
+static void double_stack_allocator_push_back(double_stack_allocator* stack,
+                                             uint8_t* ptr, size_t size,
+                                             size_t previous) {
+  memcpy(ptr + size, &previous, sizeof(previous));
+  stack->back = (size_t)(ptr - stack->buffer);
+  double_stack_allocator_track_peak(stack);
+}
+
+static void* double_stack_allocator_alloc_back(allocator* self, size_t size,
+                                               size_t alignment) {
+  double_stack_allocator* stack = (double_stack_allocator*)self->ctx;
+  uint8_t* ptr = double_stack_allocator_place_back(stack, stack->back, size,
+                                                   alignment);
+
+  if (ptr) {
+    double_stack_allocator_push_back(stack, ptr, size, stack->back);
+  }
+
+  return ptr;
+}
+
+static void* double_stack_allocator_realloc_front(allocator* self, void* ptr,
+                                                  size_t old_size,
+                                                  size_t new_size,
+                                                  size_t alignment) {
+  double_stack_allocator* stack = (double_stack_allocator*)self->ctx;
+
+  if (!ptr) {
+    return double_stack_allocator_alloc_front(self, new_size, alignment);
+  }
+
+  uint8_t* byte_ptr = (uint8_t*)ptr;
+  size_t offset = (size_t)(byte_ptr - stack->buffer);
+
+  if (offset + old_size == stack->front &&
+      ((uintptr_t)ptr & (alignment - 1)) == 0 &&
+      new_size <= stack->back - offset) {
+    stack->front = offset + new_size;
+    double_stack_allocator_track_peak(stack);
+    return ptr;
+  }
+
+  void* new_ptr = double_stack_allocator_alloc_front(self, new_size, alignment);
+
+  if (new_ptr) {
+    memcpy(new_ptr, ptr, old_size < new_size ? old_size : new_size);
+  }
+
+  return new_ptr;
+}
+
+static void* double_stack_allocator_realloc_back(allocator* self, void* ptr,
+                                                 size_t old_size,
+                                                 size_t new_size,
+                                                 size_t alignment) {
+  double_stack_allocator* stack = (double_stack_allocator*)self->ctx;
+
+  if (!ptr) {
+    return double_stack_allocator_alloc_back(self, new_size, alignment);
+  }
+
+  uint8_t* byte_ptr = (uint8_t*)ptr;
+
+  if (byte_ptr == stack->buffer + stack->back) {
+    size_t previous;
+    memcpy(&previous, byte_ptr + old_size, sizeof(previous));
+
+    uint8_t* new_ptr = double_stack_allocator_place_back(stack, previous,
+                                                         new_size, alignment);
+
+    if (new_ptr) {
+      memmove(new_ptr, ptr, old_size < new_size ? old_size : new_size);
+      double_stack_allocator_push_back(stack, new_ptr, new_size, previous);
+    }
+
+    return new_ptr;
+  }
+
+  void* new_ptr = double_stack_allocator_alloc_back(self, new_size, alignment);
+
+  if (new_ptr) {
+    memcpy(new_ptr, ptr, old_size < new_size ? old_size : new_size);
+  }
+
+  return new_ptr;
+}
+
+static void double_stack_allocator_free_front(allocator* self, void* ptr,
+                                              size_t size) {
+  double_stack_allocator* stack = (double_stack_allocator*)self->ctx;
+
+  if (!ptr)
+    return;
+
+  uint8_t* byte_ptr = (uint8_t*)ptr;
+
+  if (byte_ptr + size == stack->buffer + stack->front) {
+    stack->front = (size_t)(byte_ptr - stack->buffer);
+  }
+}
+
+static void double_stack_allocator_free_back(allocator* self, void* ptr,
+                                             size_t size) {
+  double_stack_allocator* stack = (double_stack_allocator*)self->ctx;
+
+  if (!ptr)
+    return;
+
+  uint8_t* byte_ptr = (uint8_t*)ptr;
+
+  if (byte_ptr == stack->buffer + stack->back) {
+    size_t previous;
+    memcpy(&previous, byte_ptr + size, sizeof(previous));
+    stack->back = previous;
+  }
+}
+
+static void double_stack_allocator_init(double_stack_allocator* stack,
+                                        void* buffer, size_t size) {
+  stack->buffer = (uint8_t*)buffer;
+  stack->buffer_size = size;
+  stack->front = 0;
+  stack->back = size;
+  stack->peak = 0;
+}
+
+static stack_marker double_stack_allocator_mark_front(
+    double_stack_allocator* stack) {
+  stack_marker marker = {.offset = stack->front};
+  return marker;
+}
+
+static stack_marker double_stack_allocator_mark_back(
+    double_stack_allocator* stack) {
+  stack_marker marker = {.offset = stack->back};
+  return marker;
+}
+
+static void double_stack_allocator_restore_front(double_stack_allocator* stack,
+                                                 stack_marker marker) {
+  stack->front = marker.offset;
+}
+
+static void double_stack_allocator_restore_back(double_stack_allocator* stack,
+                                                stack_marker marker) {
+  stack->back = marker.offset;
+}
+
+static void double_stack_allocator_reset(double_stack_allocator* stack) {
+  stack->front = 0;
+  stack->back = stack->buffer_size;
+}
+
+static size_t double_stack_allocator_remaining(double_stack_allocator* stack) {
+  return stack->back - stack->front;
+}
+
+static allocator double_stack_allocator_get_front(
+    double_stack_allocator* stack) {
+  allocator alloc = {.alloc = double_stack_allocator_alloc_front,
+                     .realloc = double_stack_allocator_realloc_front,
+                     .free = double_stack_allocator_free_front,
+                     .ctx = stack};
+  return alloc;
+}
+
+static allocator double_stack_allocator_get_back(
+    double_stack_allocator* stack) {
+  allocator alloc = {.alloc = double_stack_allocator_alloc_back,
+                     .realloc = double_stack_allocator_realloc_back,
+                     .free = double_stack_allocator_free_back,
+                     .ctx = stack};
+  return alloc;
+}
+
+typedef struct scratch_allocator {
+  allocator* backing;
+  void** allocations;
+  size_t allocation_count;
+  size_t allocation_capacity;
+  size_t* sizes;
+  int batch_free;
+  size_t chunk_size;
+  uint8_t* chunk;
+  size_t chunk_offset;
+} scratch_allocator;
+
+#define SCRATCH_BUMP_INDEX SIZE_MAX
+
+typedef struct scratch_header {
+  size_t index;
+} scratch_header;
+
+static inline size_t scratch_header_space(size_t alignment) {
+  return align_forward(sizeof(scratch_header), alignment);
+}
+
+static inline size_t scratch_alignment(size_t alignment) {
+  return alignment < sizeof(scratch_header) ? sizeof(scratch_header)
+                                            : alignment;
+}
+
+static int scratch_allocator_reserve(scratch_allocator* scratch) {
+  if (scratch->allocation_count < scratch->allocation_capacity) {
+    return 1;
+  }
+
+  size_t new_capacity = scratch->allocation_capacity == 0
+                            ? 8
+                            : scratch->allocation_capacity * 2;
+
+  /* Both arrays share one block, so growth either succeeds for both or
+   * leaves the old ones untouched. */
+  void** new_allocations = (void**)alloc_alloc(
+      scratch->backing, new_capacity * (sizeof(void*) + sizeof(size_t)),
+      sizeof(void*));
+
+  if (!new_allocations) {
+    return 0;
+  }
+
+  size_t* new_sizes = (size_t*)(new_allocations + new_capacity);
+
+  if (scratch->allocations) {
+    memcpy(new_allocations, scratch->allocations,
+           scratch->allocation_count * sizeof(void*));
+    memcpy(new_sizes, scratch->sizes,
+           scratch->allocation_count * sizeof(size_t));
+    alloc_free(scratch->backing, scratch->allocations,
+               scratch->allocation_capacity *
+                   (sizeof(void*) + sizeof(size_t)));
+  }
+
+  scratch->allocations = new_allocations;
+  scratch->sizes = new_sizes;
+  scratch->allocation_capacity = new_capacity;
+
+  return 1;
+}
+
+static void* scratch_allocator_bump(scratch_allocator* scratch, size_t size,
+                                    size_t alignment) {
+  uintptr_t start = (uintptr_t)(scratch->chunk + scratch->chunk_offset);
+  uintptr_t user = align_forward(start + sizeof(scratch_header), alignment);
+
+  if (!scratch->chunk ||
+      user + size > (uintptr_t)scratch->chunk + scratch->chunk_size) {
+    if (!scratch_allocator_reserve(scratch)) {
+      return NULL;
+    }
+
+    uint8_t* chunk = (uint8_t*)alloc_alloc(scratch->backing,
+                                           scratch->chunk_size, sizeof(void*));
+    if (!chunk)
+      return NULL;
+
+    scratch->allocations[scratch->allocation_count] = chunk;
+    scratch->sizes[scratch->allocation_count] = scratch->chunk_size;
+    scratch->allocation_count++;
+
+    scratch->chunk = chunk;
+    scratch->chunk_offset = 0;
+    user = align_forward((uintptr_t)chunk + sizeof(scratch_header), alignment);
+  }
+
+  ((scratch_header*)user)[-1].index = SCRATCH_BUMP_INDEX;
+  scratch->chunk_offset = (size_t)(user + size - (uintptr_t)scratch->chunk);
+
+  return (void*)user;
+}
+
+static void* scratch_allocator_alloc(allocator* self, size_t size,
+                                     size_t alignment) {
+  scratch_allocator* scratch = (scratch_allocator*)self->ctx;
+
+  alignment = scratch_alignment(alignment);
+  size_t header_space = scratch_header_space(alignment);
+  size_t total = header_space + size;
+
+  if (total <= scratch->chunk_size / 4) {
+    return scratch_allocator_bump(scratch, size, alignment);
+  }
+
+  if (!scratch_allocator_reserve(scratch)) {
+    return NULL;
+  }
+
+  uint8_t* raw = (uint8_t*)alloc_alloc(scratch->backing, total, alignment);
+
+  if (!raw)
+    return NULL;
+
+  uint8_t* ptr = raw + header_space;
+  ((scratch_header*)ptr)[-1].index = scratch->allocation_count;
+
+  scratch->allocations[scratch->allocation_count] = raw;
+  scratch->sizes[scratch->allocation_count] = total;
+  scratch->allocation_count++;
+
+  return ptr;
+}
+
+static void* scratch_allocator_realloc(allocator* self, void* ptr,
+                                       size_t old_size, size_t new_size,
+                                       size_t alignment) {
+  scratch_allocator* scratch = (scratch_allocator*)self->ctx;
+
+  if (!ptr) {
+    return scratch_allocator_alloc(self, new_size, alignment);
+  }
+
+  alignment = scratch_alignment(alignment);
+  size_t index = ((scratch_header*)ptr)[-1].index;
+
+  if (index == SCRATCH_BUMP_INDEX) {
+    uint8_t* byte_ptr = (uint8_t*)ptr;
+
+    if (byte_ptr + old_size == scratch->chunk + scratch->chunk_offset &&
+        byte_ptr + new_size <= scratch->chunk + scratch->chunk_size) {
+      scratch->chunk_offset = (size_t)(byte_ptr + new_size - scratch->chunk);
+      return ptr;
+    }
+
+    void* new_ptr = scratch_allocator_alloc(self, new_size, alignment);
+
+    if (new_ptr) {
+      memcpy(new_ptr, ptr, old_size < new_size ? old_size : new_size);
+    }
+
+    return new_ptr;
+  }
+
+  size_t header_space =
+      (size_t)((uint8_t*)ptr - (uint8_t*)scratch->allocations[index]);
+  uint8_t* raw = (uint8_t*)alloc_realloc(
+      scratch->backing, scratch->allocations[index], scratch->sizes[index],
+      header_space + new_size, alignment);
+
+  if (!raw)
+    return NULL;
+
+  scratch->allocations[index] = raw;
+  scratch->sizes[index] = header_space + new_size;
+
+  return raw + header_space;
+}
+
+static void scratch_allocator_free(allocator* self, void* ptr, size_t size) {
+  (void)self;
+  (void)ptr;
+  (void)size;
+}
+
+static void scratch_allocator_init(scratch_allocator* scratch,
+                                   allocator* backing) {
+  scratch->backing = backing;
+  scratch->allocations = NULL;
+  scratch->allocation_count = 0;
+  scratch->allocation_capacity = 0;
+  scratch->sizes = NULL;
+  scratch->batch_free = 0;
+  scratch->chunk_size = 0;
+  scratch->chunk = NULL;
+  scratch->chunk_offset = 0;
+}
+
+static void scratch_allocator_init_chunked(scratch_allocator* scratch,
+                                           allocator* backing,
+                                           size_t chunk_size) {
+  scratch_allocator_init(scratch, backing);
+  scratch->chunk_size = chunk_size;
+}
+
+static void scratch_allocator_reset(scratch_allocator* scratch) {
+  size_t count = scratch->allocation_count;
+
+  if (scratch->batch_free) {
+    size_t i = 0;
+    while (i < count) {
+      size_t run = 1;
+      while (i + run < count && scratch->sizes[i + run] == scratch->sizes[i]) {
+        run++;
+      }
+
+      alloc_free_batch(scratch->backing, &scratch->allocations[i],
+                       scratch->sizes[i], run);
+      i += run;
+    }
+  } else {
+    for (size_t i = 0; i < count; i++) {
+      alloc_free(scratch->backing, scratch->allocations[i], scratch->sizes[i]);
+    }
+  }
+
+  scratch->allocation_count = 0;
+  scratch->chunk = NULL;
+  scratch->chunk_offset = 0;
+}
+
+static void scratch_allocator_destroy(scratch_allocator* scratch) {
+  scratch_allocator_reset(scratch);
+
+  if (scratch->allocations) {
+    alloc_free(scratch->backing, scratch->allocations,
+               scratch->allocation_capacity *
+                   (sizeof(void*) + sizeof(size_t)));
+  }
+
+  scratch->allocations = NULL;
+  scratch->sizes = NULL;
+  scratch->allocation_capacity = 0;
+}
+
+static allocator scratch_allocator_get(scratch_allocator* scratch) {
+  allocator alloc = {.alloc = scratch_allocator_alloc,
+                     .realloc = scratch_allocator_realloc,
+                     .free = scratch_allocator_free,
+                     .ctx = scratch};
+  return alloc;
+}
+
+typedef struct freelist_node freelist_node;
+
+struct freelist_node {
+  size_t size;
+  freelist_node* next;
+  freelist_node* prev;
+};
+
+#define FREELIST_ALIGNMENT ((size_t)16)
+#define FREELIST_BLOCK_FREE ((size_t)1)
+#define FREELIST_PREV_FREE ((size_t)2)
+#define FREELIST_FLAGS (FREELIST_ALIGNMENT - 1)
+#define FREELIST_HEADER_SIZE (2 * sizeof(size_t))
+#define FREELIST_MIN_BLOCK                                                     \
+  ((sizeof(freelist_node) + sizeof(size_t) + FREELIST_FLAGS) & ~FREELIST_FLAGS)
+
+#define FREELIST_SL_LOG2 4
+#define FREELIST_SL_COUNT (1 << FREELIST_SL_LOG2)
+#define FREELIST_FL_SHIFT (FREELIST_SL_LOG2 + 4)
+#define FREELIST_FL_COUNT 32
+#define FREELIST_SMALL_SIZE ((size_t)1 << FREELIST_FL_SHIFT)
+
+typedef struct freelist_allocator {
+  uint8_t* buffer;
+  size_t buffer_size;
+  allocator* backing;
+  uint8_t* heap_start;
+  uint8_t* heap_end;
+  size_t free_bytes;
+  size_t peak_used;
+  uint64_t fl_bitmap;
+  uint32_t sl_bitmap[FREELIST_FL_COUNT];
+  freelist_node* bins[FREELIST_FL_COUNT][FREELIST_SL_COUNT];
+  struct freelist_latency* latency;
+} freelist_allocator;
+
+#define FREELIST_LATENCY_BUCKETS 32
+#define FREELIST_REALTIME_LOCK 1
+
+typedef struct freelist_latency {
+  uint64_t alloc_cycles[FREELIST_LATENCY_BUCKETS];
+  uint64_t free_cycles[FREELIST_LATENCY_BUCKETS];
+  uint64_t alloc_sum;
+  uint64_t free_sum;
+  uint64_t alloc_max;
+  uint64_t free_max;
+} freelist_latency;
+
+static inline int alloc_bit_scan_forward(uint64_t x) {
+#if defined(_MSC_VER)
+  unsigned long index;
+  _BitScanForward64(&index, x);
+  return (int)index;
+#else
+  return __builtin_ctzll(x);
+#endif
+}
+
+static inline int alloc_bit_scan_reverse(uint64_t x) {
+#if defined(_MSC_VER)
+  unsigned long index;
+  _BitScanReverse64(&index, x);
+  return (int)index;
+#else
+  return 63 - __builtin_clzll(x);
+#endif
+}
+
+static inline size_t freelist_block_size(freelist_node* node) {
+  return node->size & ~FREELIST_FLAGS;
+}
+
+static inline freelist_node* freelist_block_of(void* ptr) {
+  return (freelist_node*)((uint8_t*)ptr - ((size_t*)ptr)[-1]);
+}
+
+static inline void freelist_mapping(size_t size, int* fl, int* sl) {
+  if (size < FREELIST_SMALL_SIZE) {
+    *fl = 0;
+    *sl = (int)(size / (FREELIST_SMALL_SIZE / FREELIST_SL_COUNT));
+    return;
+  }
+
+  int bit = alloc_bit_scan_reverse(size);
+  *fl = bit - (FREELIST_FL_SHIFT - 1);
+  *sl = (int)(size >> (bit - FREELIST_SL_LOG2)) ^ FREELIST_SL_COUNT;
+
+  if (*fl >= FREELIST_FL_COUNT) {
+    *fl = FREELIST_FL_COUNT - 1;
+    *sl = FREELIST_SL_COUNT - 1;
+  }
+}
+
+static freelist_node* freelist_allocator_find(freelist_allocator* freelist,
+                                              size_t size) {
+  if (size >= FREELIST_SMALL_SIZE) {
+    size += ((size_t)1 << (alloc_bit_scan_reverse(size) - FREELIST_SL_LOG2)) -
+            1;
+  }
+
+  int fl, sl;
+  freelist_mapping(size, &fl, &sl);
+
+  uint32_t sl_map = freelist->sl_bitmap[fl] & (~(uint32_t)0 << sl);
+
+  if (!sl_map) {
+    uint64_t fl_map = freelist->fl_bitmap & (~(uint64_t)0 << (fl + 1));
+    if (!fl_map) {
+      return NULL;
+    }
+
+    fl = alloc_bit_scan_forward(fl_map);
+    sl_map = freelist->sl_bitmap[fl];
+  }
+
+  sl = alloc_bit_scan_forward(sl_map);
+  return freelist->bins[fl][sl];
+}
+
+static void freelist_allocator_unlink(freelist_allocator* freelist,
+                                      freelist_node* node) {
+  int fl, sl;
+  freelist_mapping(freelist_block_size(node), &fl, &sl);
+
+  if (node->prev) {
+    node->prev->next = node->next;
+  } else {
+    freelist->bins[fl][sl] = node->next;
+    if (!node->next) {
+      freelist->sl_bitmap[fl] &= ~((uint32_t)1 << sl);
+      if (!freelist->sl_bitmap[fl]) {
+        freelist->fl_bitmap &= ~((uint64_t)1 << fl);
+      }
+    }
+  }
+
+  if (node->next) {
+    node->next->prev = node->prev;
+  }
+
+  freelist->free_bytes -= freelist_block_size(node);
+}
+
+static void freelist_allocator_insert(freelist_allocator* freelist,
+                                      freelist_node* node, size_t size) {
+  node->size = size | FREELIST_BLOCK_FREE;
+  *(size_t*)((uint8_t*)node + size - sizeof(size_t)) = size;
+
+  freelist_node* next = (freelist_node*)((uint8_t*)node + size);
+  if ((uint8_t*)next < freelist->heap_end) {
+    next->size |= FREELIST_PREV_FREE;
+  }
+
+  int fl, sl;
+  freelist_mapping(size, &fl, &sl);
+
+  node->prev = NULL;
+  node->next = freelist->bins[fl][sl];
+  if (node->next) {
+    node->next->prev = node;
+  }
+  freelist->bins[fl][sl] = node;
+  freelist->sl_bitmap[fl] |= (uint32_t)1 << sl;
+  freelist->fl_bitmap |= (uint64_t)1 << fl;
+
+  freelist->free_bytes += size;
+}
+
+static void freelist_allocator_release(freelist_allocator* freelist,
+                                       freelist_node* node,
+                                       size_t block_size) {
+  freelist_node* next = (freelist_node*)((uint8_t*)node + block_size);
+  if ((uint8_t*)next < freelist->heap_end &&
+      (next->size & FREELIST_BLOCK_FREE)) {
+    block_size += freelist_block_size(next);
+    freelist_allocator_unlink(freelist, next);
+  }
+
+  if (node->size & FREELIST_PREV_FREE) {
+    size_t prev_size = ((size_t*)node)[-1];
+    node = (freelist_node*)((uint8_t*)node - prev_size);
+    block_size += prev_size;
+    freelist_allocator_unlink(freelist, node);
+  }
+
+  freelist_allocator_insert(freelist, node, block_size);
+}
+
+static inline void freelist_allocator_track_peak(freelist_allocator* freelist) {
+  size_t heap_size = (size_t)(freelist->heap_end - freelist->heap_start);
+  size_t used = heap_size - freelist->free_bytes;
+
+  if (used > freelist->peak_used) {
+    freelist->peak_used = used;
+  }
+}
+
+static inline uint64_t alloc_cycle_count(void) {
+#if defined(_MSC_VER) && (defined(_M_X64) || defined(_M_IX86))
+  return __rdtsc();
+#elif (defined(__GNUC__) || defined(__clang__)) && \
+    (defined(__x86_64__) || defined(__i386__))
+  return __builtin_ia32_rdtsc();
+#elif (defined(__GNUC__) || defined(__clang__)) && defined(__aarch64__)
+  uint64_t ticks;
+  __asm__ __volatile__("mrs %0, cntvct_el0" : "=r"(ticks));
+  return ticks;
+#elif defined(_WIN32)
+  LARGE_INTEGER counter;
+  QueryPerformanceCounter(&counter);
+  return (uint64_t)counter.QuadPart;
+#else
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t)ts.tv_sec * 1000000000ull + (uint64_t)ts.tv_nsec;
+#endif
+}
+
+static inline int freelist_latency_bucket(uint64_t cycles) {
+  int bucket = cycles ? alloc_bit_scan_reverse(cycles) : 0;
+  return bucket < FREELIST_LATENCY_BUCKETS ? bucket
+                                           : FREELIST_LATENCY_BUCKETS - 1;
+}
+
+static void freelist_allocator_free(allocator* self, void* ptr, size_t size);
+
+static void* freelist_allocator_take(freelist_allocator* freelist,
+                                     size_t size, size_t alignment) {
+  size_t heap_size = (size_t)(freelist->heap_end - freelist->heap_start);
+
+  if (size > heap_size || alignment > heap_size) {
+    return NULL;
+  }
+
+  size_t padding =
+      alignment > FREELIST_ALIGNMENT ? alignment - FREELIST_ALIGNMENT : 0;
+  size_t search_size =
+      align_forward(FREELIST_HEADER_SIZE + padding + size, FREELIST_ALIGNMENT);
+
+  if (search_size < FREELIST_MIN_BLOCK) {
+    search_size = FREELIST_MIN_BLOCK;
+  }
+
+  freelist_node* node = freelist_allocator_find(freelist, search_size);
+
+  if (!node || freelist_block_size(node) < search_size) {
+    return NULL;
+  }
+
+  size_t block_size = freelist_block_size(node);
+  uintptr_t addr = (uintptr_t)node;
+  uintptr_t user_addr = align_forward(addr + FREELIST_HEADER_SIZE, alignment);
+  size_t needed = align_forward(user_addr + size - addr, FREELIST_ALIGNMENT);
+
+  if (needed < FREELIST_MIN_BLOCK) {
+    needed = FREELIST_MIN_BLOCK;
+  }
+
+  freelist_allocator_unlink(freelist, node);
+
+  if (block_size - needed >= FREELIST_MIN_BLOCK) {
+    freelist_allocator_insert(freelist,
+                              (freelist_node*)((uint8_t*)node + needed),
+                              block_size - needed);
+    block_size = needed;
+  } else {
+    freelist_node* next = (freelist_node*)((uint8_t*)node + block_size);
+    if ((uint8_t*)next < freelist->heap_end) {
+      next->size &= ~FREELIST_PREV_FREE;
+    }
+  }
+
+  node->size = block_size;
+  ((size_t*)user_addr)[-1] = user_addr - addr;
+
+  freelist_allocator_track_peak(freelist);
+
+  return (void*)user_addr;
+}
+
+static void* freelist_allocator_alloc(allocator* self, size_t size,
+                                      size_t alignment) {
+  freelist_allocator* freelist = (freelist_allocator*)self->ctx;
+  freelist_latency* latency = freelist->latency;
+
+  if (!latency) {
+    return freelist_allocator_take(freelist, size, alignment);
+  }
+
+  uint64_t start = alloc_cycle_count();
+  void* ptr = freelist_allocator_take(freelist, size, alignment);
+  uint64_t cycles = alloc_cycle_count() - start;
+
+  latency->alloc_cycles[freelist_latency_bucket(cycles)]++;
+  latency->alloc_sum += cycles;
+  if (cycles > latency->alloc_max) {
+    latency->alloc_max = cycles;
+  }
+
+  return ptr;
+}
+
+static void* freelist_allocator_realloc(allocator* self, void* ptr,
+                                        size_t old_size, size_t new_size,
+                                        size_t alignment) {
+  freelist_allocator* freelist = (freelist_allocator*)self->ctx;
+
+  if (!ptr) {
+    return freelist_allocator_alloc(self, new_size, alignment);
+  }
+
+  if (((uintptr_t)ptr & (alignment - 1)) == 0) {
+    freelist_node* node = freelist_block_of(ptr);
+    size_t block_size = freelist_block_size(node);
+    size_t prev_flag = node->size & FREELIST_PREV_FREE;
+    size_t needed = align_forward((size_t)((uint8_t*)ptr - (uint8_t*)node) +
+                                      new_size,
+                                  FREELIST_ALIGNMENT);
+
+    if (needed < FREELIST_MIN_BLOCK) {
+      needed = FREELIST_MIN_BLOCK;
+    }
+
+    if (needed <= block_size) {
+      if (block_size - needed >= FREELIST_MIN_BLOCK) {
+        freelist_node* tail = (freelist_node*)((uint8_t*)node + needed);
+        tail->size = block_size - needed;
+        node->size = needed | prev_flag;
+        freelist_allocator_release(freelist, tail, block_size - needed);
+      }
+
+      return ptr;
+    }
+
+    freelist_node* next = (freelist_node*)((uint8_t*)node + block_size);
+
+    if ((uint8_t*)next < freelist->heap_end &&
+        (next->size & FREELIST_BLOCK_FREE) &&
+        block_size + freelist_block_size(next) >= needed) {
+      size_t total = block_size + freelist_block_size(next);
+      freelist_allocator_unlink(freelist, next);
+
+      if (total - needed >= FREELIST_MIN_BLOCK) {
+        freelist_allocator_insert(freelist,
+                                  (freelist_node*)((uint8_t*)node + needed),
+                                  total - needed);
+        total = needed;
+      } else {
+        freelist_node* after = (freelist_node*)((uint8_t*)node + total);
+        if ((uint8_t*)after < freelist->heap_end) {
+          after->size &= ~FREELIST_PREV_FREE;
+        }
+      }
+
+      node->size = total | prev_flag;
+      freelist_allocator_track_peak(freelist);
+
+      return ptr;
+    }
+  }
+
+  void* new_ptr = freelist_allocator_alloc(self, new_size, alignment);
+
+  if (new_ptr && ptr) {
+    memcpy(new_ptr, ptr, old_size < new_size ? old_size : new_size);
+    freelist_allocator_free(self, ptr, old_size);
+  }
+
+  return new_ptr;
+}
+
+static void freelist_allocator_free(allocator* self, void* ptr, size_t size) {
+  freelist_allocator* freelist = (freelist_allocator*)self->ctx;
+  (void)size;
+
+  if (!ptr)
+    return;
+
+  freelist_latency* latency = freelist->latency;
+  uint64_t start = latency ? alloc_cycle_count() : 0;
+
+  freelist_node* node = freelist_block_of(ptr);
+  freelist_allocator_release(freelist, node, freelist_block_size(node));
+
+  if (latency) {
+    uint64_t cycles = alloc_cycle_count() - start;
+    latency->free_cycles[freelist_latency_bucket(cycles)]++;
+    latency->free_sum += cycles;
+    if (cycles > latency->free_max) {
+      latency->free_max = cycles;
+    }
+  }
+}
+
+static void freelist_allocator_init(freelist_allocator* freelist, void* buffer,
+                                    size_t size) {
+  freelist->buffer = (uint8_t*)buffer;
+  freelist->buffer_size = size;
+  freelist->backing = NULL;
+  freelist->free_bytes = 0;
+  freelist->peak_used = 0;
+  freelist->fl_bitmap = 0;
+  freelist->latency = NULL;
+  memset(freelist->sl_bitmap, 0, sizeof(freelist->sl_bitmap));
+  memset(freelist->bins, 0, sizeof(freelist->bins));
+
+  uintptr_t start = align_forward((uintptr_t)buffer, FREELIST_ALIGNMENT);
+  uintptr_t end = (uintptr_t)buffer + size;
+  size_t heap_size = start < end ? (end - start) & ~FREELIST_FLAGS : 0;
+
+  freelist->heap_start = (uint8_t*)start;
+  freelist->heap_end = (uint8_t*)start + heap_size;
+
+  if (heap_size >= FREELIST_MIN_BLOCK) {
+    freelist_allocator_insert(freelist, (freelist_node*)start, heap_size);
+  }
+}
+
+static int freelist_allocator_init_realtime(freelist_allocator* freelist,
+                                            void* buffer, size_t size,
+                                            freelist_latency* latency,
+                                            int flags) {
+#if defined(_WIN32)
+  SYSTEM_INFO info;
+  GetSystemInfo(&info);
+  size_t page_size = info.dwPageSize;
+#else
+  size_t page_size = (size_t)sysconf(_SC_PAGESIZE);
+#endif
+
+  volatile uint8_t* bytes = (volatile uint8_t*)buffer;
+  for (size_t i = 0; i < size; i += page_size) {
+    bytes[i] = 0;
+  }
+
+  int locked = 1;
+
+  if (flags & FREELIST_REALTIME_LOCK) {
+#if defined(_WIN32)
+    locked = VirtualLock(buffer, size) != 0;
+#else
+    locked = mlock(buffer, size) == 0;
+#endif
+  }
+
+  freelist_allocator_init(freelist, buffer, size);
+
+  if (latency) {
+    memset(latency, 0, sizeof(*latency));
+    freelist->latency = latency;
+  }
+
+  return locked;
+}
+
+static size_t freelist_allocator_largest_free(freelist_allocator* freelist) {
+  if (!freelist->fl_bitmap) {
+    return 0;
+  }
+
+  int fl = alloc_bit_scan_reverse(freelist->fl_bitmap);
+  int sl = alloc_bit_scan_reverse(freelist->sl_bitmap[fl]);
+  size_t largest = 0;
+
+  for (freelist_node* node = freelist->bins[fl][sl]; node; node = node->next) {
+    if (freelist_block_size(node) > largest) {
+      largest = freelist_block_size(node);
+    }
+  }
+
+  return largest;
+}
+
+static double freelist_allocator_fragmentation(freelist_allocator* freelist) {
+  if (freelist->free_bytes == 0) {
+    return 0.0;
+  }
+
+  return 1.0 - (double)freelist_allocator_largest_free(freelist) /
+                   (double)freelist->free_bytes;
+}
+
+static allocator freelist_allocator_get(freelist_allocator* freelist) {
+  allocator alloc = {.alloc = freelist_allocator_alloc,
+                     .realloc = freelist_allocator_realloc,
+                     .free = freelist_allocator_free,
+                     .ctx = freelist};
+  return alloc;
+}
+
+#define BUDDY_MIN_BLOCK ((size_t)16)
+#define BUDDY_MAX_ORDERS 48
+
+typedef struct buddy_block buddy_block;
+
+struct buddy_block {
+  buddy_block* next;
+  buddy_block* prev;
+};
+
+typedef struct buddy_allocator {
+  uint8_t* base;
+  size_t size;
+  allocator* backing;
+  int min_log2;
+  int top;
+  uint64_t free_orders;
+  buddy_block* free_lists[BUDDY_MAX_ORDERS];
+  size_t pair_base[BUDDY_MAX_ORDERS];
+  size_t split_base[BUDDY_MAX_ORDERS];
+  uint64_t* bits;
+  size_t metadata_size;
+  size_t free_bytes;
+} buddy_allocator;
+
+static inline int buddy_order_of(buddy_allocator* buddy, size_t size) {
+  if (size <= ((size_t)1 << buddy->min_log2)) {
+    return 0;
+  }
+
+  return alloc_bit_scan_reverse((uint64_t)(size - 1)) + 1 - buddy->min_log2;
+}
+
+static inline size_t buddy_block_size(buddy_allocator* buddy, int order) {
+  return (size_t)1 << (buddy->min_log2 + order);
+}
+
+/* One bit per buddy pair: set when exactly one half is on a free list. */
+static inline int buddy_toggle_pair(buddy_allocator* buddy, size_t offset,
+                                    int order) {
+  size_t index = buddy->pair_base[order] +
+                 (offset >> (buddy->min_log2 + order + 1));
+  uint64_t mask = (uint64_t)1 << (index & 63);
+  buddy->bits[index >> 6] ^= mask;
+  return (buddy->bits[index >> 6] & mask) != 0;
+}
+
+/* One bit per node: set while the block has been split into its halves. */
+static inline void buddy_set_split(buddy_allocator* buddy, size_t offset,
+                                   int order, int split) {
+  size_t index = buddy->split_base[order] +
+                 (offset >> (buddy->min_log2 + order));
+  uint64_t mask = (uint64_t)1 << (index & 63);
+
+  if (split) {
+    buddy->bits[index >> 6] |= mask;
+  } else {
+    buddy->bits[index >> 6] &= ~mask;
+  }
+}
+
+static inline int buddy_is_split(buddy_allocator* buddy, size_t offset,
+                                 int order) {
+  size_t index = buddy->split_base[order] +
+                 (offset >> (buddy->min_log2 + order));
+  return (buddy->bits[index >> 6] >> (index & 63)) & 1;
+}
+
+static inline void buddy_push(buddy_allocator* buddy, uint8_t* ptr,
+                              int order) {
+  buddy_block* block = (buddy_block*)ptr;
+  ALLOC_ASAN_UNPOISON(block, sizeof(buddy_block));
+  block->prev = NULL;
+  block->next = buddy->free_lists[order];
+  if (block->next) {
+    block->next->prev = block;
+  }
+  buddy->free_lists[order] = block;
+  buddy->free_orders |= (uint64_t)1 << order;
+}
+
+static inline void buddy_unlink(buddy_allocator* buddy, buddy_block* block,
+                                int order) {
+  if (block->prev) {
+    block->prev->next = block->next;
+  } else {
+    buddy->free_lists[order] = block->next;
+    if (!block->next) {
+      buddy->free_orders &= ~((uint64_t)1 << order);
+    }
+  }
+
+  if (block->next) {
+    block->next->prev = block->prev;
+  }
+}
+
+/* The smallest order the size can map to is a lower bound; the block was
+ * handed out at the first ancestor that is still whole. */
+static int buddy_find_order(buddy_allocator* buddy, size_t offset,
+                            size_t size) {
+  int order = buddy_order_of(buddy, size);
+
+  while (order < buddy->top && !buddy_is_split(buddy, offset, order + 1)) {
+    order++;
+  }
+
+  return order;
+}
+
+static void* buddy_allocator_take(buddy_allocator* buddy, int order) {
+  if (order > buddy->top) {
+    return NULL;
+  }
+
+  uint64_t available = buddy->free_orders & (~(uint64_t)0 << order);
+
+  if (!available) {
+    return NULL;
+  }
+
+  int current = alloc_bit_scan_forward(available);
+  buddy_block* block = buddy->free_lists[current];
+  size_t offset = (size_t)((uint8_t*)block - buddy->base);
+
+  buddy_unlink(buddy, block, current);
+  if (current < buddy->top) {
+    buddy_toggle_pair(buddy, offset, current);
+  }
+
+  while (current > order) {
+    buddy_set_split(buddy, offset, current, 1);
+    current--;
+    buddy_push(buddy, (uint8_t*)block + buddy_block_size(buddy, current),
+               current);
+    buddy_toggle_pair(buddy, offset, current);
+  }
+
+  buddy->free_bytes -= buddy_block_size(buddy, order);
+  ALLOC_ASAN_UNPOISON(block, buddy_block_size(buddy, order));
+
+  return block;
+}
+
+static void buddy_allocator_release(buddy_allocator* buddy, size_t offset,
+                                    int order) {
+  buddy->free_bytes += buddy_block_size(buddy, order);
+
+  while (order < buddy->top && !buddy_toggle_pair(buddy, offset, order)) {
+    size_t buddy_offset = offset ^ buddy_block_size(buddy, order);
+    buddy_unlink(buddy, (buddy_block*)(buddy->base + buddy_offset), order);
+    offset &= ~buddy_block_size(buddy, order);
+    order++;
+    buddy_set_split(buddy, offset, order, 0);
+  }
+
+  ALLOC_ASAN_POISON(buddy->base + offset, buddy_block_size(buddy, order));
+  buddy_push(buddy, buddy->base + offset, order);
+}
+
+static void* buddy_allocator_alloc(allocator* self, size_t size,
+                                   size_t alignment) {
+  buddy_allocator* buddy = (buddy_allocator*)self->ctx;
+  return buddy_allocator_take(
+      buddy, buddy_order_of(buddy, size > alignment ? size : alignment));
+}
+
+static void buddy_allocator_free(allocator* self, void* ptr, size_t size) {
+  buddy_allocator* buddy = (buddy_allocator*)self->ctx;
+
+  if (!ptr)
+    return;
+
+  size_t offset = (size_t)((uint8_t*)ptr - buddy->base);
+  buddy_allocator_release(buddy, offset,
+                          buddy_find_order(buddy, offset, size));
+}
+
+static void* buddy_allocator_realloc(allocator* self, void* ptr,
+                                     size_t old_size, size_t new_size,
+                                     size_t alignment) {
+  buddy_allocator* buddy = (buddy_allocator*)self->ctx;
+
+  if (!ptr) {
+    return buddy_allocator_alloc(self, new_size, alignment);
+  }
+
+  size_t offset = (size_t)((uint8_t*)ptr - buddy->base);
+  int order = buddy_find_order(buddy, offset, old_size);
+  int wanted =
+      buddy_order_of(buddy, new_size > alignment ? new_size : alignment);
+
+  if (wanted == order) {
+    return ptr;
+  }
+
+  if (wanted < order) {
+    while (order > wanted) {
+      buddy_set_split(buddy, offset, order, 1);
+      order--;
+      buddy_allocator_release(buddy, offset + buddy_block_size(buddy, order),
+                              order);
+    }
+    return ptr;
+  }
+
+  void* new_ptr = buddy_allocator_take(buddy, wanted);
+
+  if (new_ptr) {
+    memcpy(new_ptr, ptr, old_size < new_size ? old_size : new_size);
+    buddy_allocator_release(buddy, offset, order);
+  }
+
+  return new_ptr;
+}
+
+static int buddy_allocator_init(buddy_allocator* buddy, void* buffer,
+                                size_t size, size_t min_block) {
+  memset(buddy, 0, sizeof(*buddy));
+
+  if (min_block < BUDDY_MIN_BLOCK) {
+    min_block = BUDDY_MIN_BLOCK;
+  }
+
+  buddy->min_log2 = alloc_bit_scan_reverse((uint64_t)(min_block - 1)) + 1;
+
+  /* Natural alignment: the region is aligned to its own power-of-two size,
+   * so every block is aligned to its size. */
+  uintptr_t start = (uintptr_t)buffer;
+  uintptr_t end = start + size;
+  size_t region = 0;
+
+  for (int bit = size ? alloc_bit_scan_reverse((uint64_t)size) : 0;
+       bit >= buddy->min_log2 && !region; bit--) {
+    uintptr_t aligned = align_forward(start, (size_t)1 << bit);
+    if (aligned >= start && aligned + ((size_t)1 << bit) <= end) {
+      region = (size_t)1 << bit;
+      start = aligned;
+    }
+  }
+
+  int top = region ? alloc_bit_scan_reverse((uint64_t)region) -
+                         buddy->min_log2
+                   : -1;
+
+  if (top < 0 || top >= BUDDY_MAX_ORDERS) {
+    return 0;
+  }
+
+  size_t bit_count = 0;
+  for (int order = 0; order <= top; order++) {
+    buddy->split_base[order] = bit_count;
+    bit_count += region >> (buddy->min_log2 + order);
+    buddy->pair_base[order] = bit_count;
+    bit_count += (region >> (buddy->min_log2 + order)) / 2;
+  }
+
+  buddy->base = (uint8_t*)start;
+  buddy->size = region;
+  buddy->top = top;
+  buddy->metadata_size = ((bit_count + 63) / 64) * sizeof(uint64_t);
+
+  /* The bitmaps live in the first block, carved out by hand since splitting
+   * only ever writes free-list links into upper halves. */
+  int meta_order = buddy_order_of(buddy, buddy->metadata_size);
+
+  if (meta_order > top) {
+    return 0;
+  }
+
+  buddy->bits = (uint64_t*)buddy->base;
+  memset(buddy->bits, 0, buddy->metadata_size);
+  ALLOC_ASAN_POISON(buddy->base, region);
+  ALLOC_ASAN_UNPOISON(buddy->base, buddy->metadata_size);
+
+  for (int order = top; order > meta_order; order--) {
+    buddy_set_split(buddy, 0, order, 1);
+    buddy_push(buddy, buddy->base + buddy_block_size(buddy, order - 1),
+               order - 1);
+    buddy_toggle_pair(buddy, 0, order - 1);
+  }
+
+  buddy->free_bytes = region - buddy_block_size(buddy, meta_order);
+  return 1;
+}
+
+static int buddy_allocator_init_backing(buddy_allocator* buddy,
+                                        allocator* backing, size_t size,
+                                        size_t min_block) {
+  /* Past the largest power of two, region would overflow to zero. */
+  if (size > SIZE_MAX / 2 + 1) {
+    memset(buddy, 0, sizeof(*buddy));
+    return 0;
+  }
+
+  size_t region = BUDDY_MIN_BLOCK;
+  while (region < size) {
+    region <<= 1;
+  }
+
+  void* buffer = alloc_alloc(backing, region, region);
+
+  if (!buffer) {
+    memset(buddy, 0, sizeof(*buddy));
+    return 0;
+  }
+
+  if (!buddy_allocator_init(buddy, buffer, region, min_block)) {
+    alloc_free(backing, buffer, region);
+    return 0;
+  }
+
+  buddy->backing = backing;
+  return 1;
+}
+
+static void buddy_allocator_destroy(buddy_allocator* buddy) {
+  ALLOC_ASAN_UNPOISON(buddy->base, buddy->size);
+
+  if (buddy->backing) {
+    alloc_free(buddy->backing, buddy->base, buddy->size);
+  }
+
+  memset(buddy, 0, sizeof(*buddy));
+}
+
+static size_t buddy_allocator_largest_free(buddy_allocator* buddy) {
+  if (!buddy->free_orders) {
+    return 0;
+  }
+
+  return buddy_block_size(buddy,
+                          alloc_bit_scan_reverse(buddy->free_orders));
+}
+
+static allocator buddy_allocator_get(buddy_allocator* buddy) {
+  allocator alloc = {.alloc = buddy_allocator_alloc,
+                     .realloc = buddy_allocator_realloc,
+                     .free = buddy_allocator_free,
+                     .ctx = buddy};
+  return alloc;
+}
+
+#define TCACHE_MIN_SIZE ((size_t)16)
+#define TCACHE_CLASS_COUNT 9
+#define TCACHE_MAX_SIZE (TCACHE_MIN_SIZE << (TCACHE_CLASS_COUNT - 1))
+#define TCACHE_MAGAZINE_CAPACITY 64
+
+typedef struct tcache_allocator tcache_allocator;
+typedef struct tcache_thread_cache tcache_thread_cache;
+
+typedef struct tcache_magazine {
+  size_t count;
+  void* slots[TCACHE_MAGAZINE_CAPACITY];
+} tcache_magazine;
+
+struct tcache_thread_cache {
+  tcache_allocator* owner;
+  tcache_thread_cache* prev;
+  tcache_thread_cache* next;
+  size_t cached_bytes;
+  tcache_magazine magazines[TCACHE_CLASS_COUNT];
+};
+
+struct tcache_allocator {
+  allocator* backing;
+  alloc_mutex lock;
+  alloc_tls_key key;
+  size_t magazine_size;
+  size_t batch_size;
+  size_t max_cached_bytes;
+  tcache_thread_cache* caches;
+};
+
+static inline int tcache_class(size_t size) {
+  if (size <= TCACHE_MIN_SIZE) {
+    return 0;
+  }
+
+  return alloc_bit_scan_reverse(size - 1) - 3;
+}
+
+static inline size_t tcache_class_size(int size_class) {
+  return TCACHE_MIN_SIZE << size_class;
+}
+
+static void tcache_allocator_flush_class(tcache_allocator* tcache,
+                                         tcache_thread_cache* cache,
+                                         int size_class, size_t keep) {
+  tcache_magazine* magazine = &cache->magazines[size_class];
+  size_t class_size = tcache_class_size(size_class);
+
+  if (magazine->count <= keep) {
+    return;
+  }
+
+  alloc_mutex_lock(&tcache->lock);
+  alloc_free_batch(tcache->backing, &magazine->slots[keep], class_size,
+                   magazine->count - keep);
+  alloc_mutex_unlock(&tcache->lock);
+
+  cache->cached_bytes -= (magazine->count - keep) * class_size;
+  magazine->count = keep;
+}
+
+static void tcache_allocator_release_cache(tcache_allocator* tcache,
+                                           tcache_thread_cache* cache) {
+  for (int i = 0; i < TCACHE_CLASS_COUNT; i++) {
+    tcache_allocator_flush_class(tcache, cache, i, 0);
+  }
+
+  alloc_mutex_lock(&tcache->lock);
+  if (cache->prev) {
+    cache->prev->next = cache->next;
+  } else {
+    tcache->caches = cache->next;
+  }
+  if (cache->next) {
+    cache->next->prev = cache->prev;
+  }
+  alloc_free(tcache->backing, cache, sizeof(tcache_thread_cache));
+  alloc_mutex_unlock(&tcache->lock);
+}
+
+static void tcache_allocator_thread_exit(void* value) {
+  tcache_thread_cache* cache = (tcache_thread_cache*)value;
+
+  if (cache) {
+    tcache_allocator_release_cache(cache->owner, cache);
+  }
+}
+
+static tcache_thread_cache* tcache_allocator_cache(tcache_allocator* tcache) {
+  tcache_thread_cache* cache =
+      (tcache_thread_cache*)alloc_tls_get(tcache->key);
+
+  if (cache) {
+    return cache;
+  }
+
+  alloc_mutex_lock(&tcache->lock);
+  cache = (tcache_thread_cache*)alloc_alloc(
+      tcache->backing, sizeof(tcache_thread_cache), sizeof(void*));
+
+  if (cache) {
+    memset(cache, 0, sizeof(tcache_thread_cache));
+    cache->owner = tcache;
+    cache->next = tcache->caches;
+    if (tcache->caches) {
+      tcache->caches->prev = cache;
+    }
+    tcache->caches = cache;
+  }
+  alloc_mutex_unlock(&tcache->lock);
+
+  if (cache) {
+    alloc_tls_set(tcache->key, cache);
+  }
+
+  return cache;
+}
+
+static void* tcache_allocator_alloc_locked(tcache_allocator* tcache,
+                                           size_t size, size_t alignment) {
+  alloc_mutex_lock(&tcache->lock);
+  void* ptr = alloc_alloc(tcache->backing, size, alignment);
+  alloc_mutex_unlock(&tcache->lock);
+  return ptr;
+}
+
+static void* tcache_allocator_alloc(allocator* self, size_t size,
+                                    size_t alignment) {
+  tcache_allocator* tcache = (tcache_allocator*)self->ctx;
+
+  if (size > TCACHE_MAX_SIZE) {
+    return tcache_allocator_alloc_locked(tcache, size, alignment);
+  }
+
+  int size_class = tcache_class(size);
+  size_t class_size = tcache_class_size(size_class);
+
+  if (alignment > TCACHE_MIN_SIZE) {
+    return tcache_allocator_alloc_locked(tcache, class_size, alignment);
+  }
+
+  tcache_thread_cache* cache = tcache_allocator_cache(tcache);
+
+  if (!cache) {
+    return tcache_allocator_alloc_locked(tcache, class_size, TCACHE_MIN_SIZE);
+  }
+
+  tcache_magazine* magazine = &cache->magazines[size_class];
+
+  if (magazine->count == 0) {
+    alloc_mutex_lock(&tcache->lock);
+    magazine->count =
+        alloc_alloc_batch(tcache->backing, class_size, TCACHE_MIN_SIZE,
+                          magazine->slots, tcache->batch_size);
+    alloc_mutex_unlock(&tcache->lock);
+
+    cache->cached_bytes += magazine->count * class_size;
+
+    if (magazine->count == 0) {
+      return NULL;
+    }
+  }
+
+  cache->cached_bytes -= class_size;
+  return magazine->slots[--magazine->count];
+}
+
+static void tcache_allocator_free(allocator* self, void* ptr, size_t size);
+
+static void* tcache_allocator_realloc(allocator* self, void* ptr,
+                                      size_t old_size, size_t new_size,
+                                      size_t alignment) {
+  tcache_allocator* tcache = (tcache_allocator*)self->ctx;
+
+  if (!ptr) {
+    return tcache_allocator_alloc(self, new_size, alignment);
+  }
+
+  if (old_size > TCACHE_MAX_SIZE && new_size > TCACHE_MAX_SIZE) {
+    alloc_mutex_lock(&tcache->lock);
+    void* new_ptr =
+        alloc_realloc(tcache->backing, ptr, old_size, new_size, alignment);
+    alloc_mutex_unlock(&tcache->lock);
+    return new_ptr;
+  }
+
+  if (old_size <= TCACHE_MAX_SIZE && new_size <= TCACHE_MAX_SIZE &&
+      tcache_class(old_size) == tcache_class(new_size) &&
+      ((uintptr_t)ptr & (alignment - 1)) == 0) {
+    return ptr;
+  }
+
+  void* new_ptr = tcache_allocator_alloc(self, new_size, alignment);
+
+  if (new_ptr) {
+    memcpy(new_ptr, ptr, old_size < new_size ? old_size : new_size);
+    tcache_allocator_free(self, ptr, old_size);
+  }
+
+  return new_ptr;
+}
+
+static void tcache_allocator_free(allocator* self, void* ptr, size_t size) {
+  tcache_allocator* tcache = (tcache_allocator*)self->ctx;
+
+  if (!ptr)
+    return;
+
+  if (size > TCACHE_MAX_SIZE) {
+    alloc_mutex_lock(&tcache->lock);
+    alloc_free(tcache->backing, ptr, size);
+    alloc_mutex_unlock(&tcache->lock);
+    return;
+  }
+
+  int size_class = tcache_class(size);
+  size_t class_size = tcache_class_size(size_class);
+  tcache_thread_cache* cache = tcache_allocator_cache(tcache);
+
+  if (!cache) {
+    alloc_mutex_lock(&tcache->lock);
+    alloc_free(tcache->backing, ptr, class_size);
+    alloc_mutex_unlock(&tcache->lock);
+    return;
+  }
+
+  tcache_magazine* magazine = &cache->magazines[size_class];
+
+  if (magazine->count >= tcache->magazine_size) {
+    tcache_allocator_flush_class(
+        tcache, cache, size_class,
+        magazine->count > tcache->batch_size
+            ? magazine->count - tcache->batch_size
+            : 0);
+  }
+
+  magazine->slots[magazine->count++] = ptr;
+  cache->cached_bytes += class_size;
+
+  for (int i = TCACHE_CLASS_COUNT - 1;
+       i >= 0 && cache->cached_bytes > tcache->max_cached_bytes; i--) {
+    tcache_allocator_flush_class(tcache, cache, i, 0);
+  }
+}
+
+/* Sets the per-thread cache bounds. The magazine size is clamped to
+ * [1, TCACHE_MAGAZINE_CAPACITY] and the batch size to [1, magazine_size].
+ * Call before any thread allocates from the cache. */
+static void tcache_allocator_set_limits(tcache_allocator* tcache,
+                                        size_t magazine_size,
+                                        size_t batch_size,
+                                        size_t max_cached_bytes) {
+  if (magazine_size > TCACHE_MAGAZINE_CAPACITY) {
+    magazine_size = TCACHE_MAGAZINE_CAPACITY;
+  }
+  if (magazine_size == 0) {
+    magazine_size = 1;
+  }
+  if (batch_size > magazine_size) {
+    batch_size = magazine_size;
+  }
+  if (batch_size == 0) {
+    batch_size = 1;
+  }
+
+  tcache->magazine_size = magazine_size;
+  tcache->batch_size = batch_size;
+  tcache->max_cached_bytes = max_cached_bytes;
+}
+
+static void tcache_allocator_init(tcache_allocator* tcache,
+                                  allocator* backing) {
+  tcache->backing = backing;
+  tcache_allocator_set_limits(tcache, TCACHE_MAGAZINE_CAPACITY,
+                              TCACHE_MAGAZINE_CAPACITY / 2, 256 * 1024);
+  tcache->caches = NULL;
+  alloc_mutex_init(&tcache->lock);
+  alloc_tls_create(&tcache->key, tcache_allocator_thread_exit);
+}
+
+static void tcache_allocator_flush(tcache_allocator* tcache) {
+  tcache_thread_cache* cache =
+      (tcache_thread_cache*)alloc_tls_get(tcache->key);
+
+  if (!cache)
+    return;
+
+  for (int i = 0; i < TCACHE_CLASS_COUNT; i++) {
+    tcache_allocator_flush_class(tcache, cache, i, 0);
+  }
+}
+
+static void tcache_allocator_destroy(tcache_allocator* tcache) {
+  while (tcache->caches) {
+    tcache_allocator_release_cache(tcache, tcache->caches);
+  }
+
+  alloc_tls_delete(tcache->key);
+  alloc_mutex_destroy(&tcache->lock);
+}
+
+static allocator tcache_allocator_get(tcache_allocator* tcache) {
+  allocator alloc = {.alloc = tcache_allocator_alloc,
+                     .realloc = tcache_allocator_realloc,
+                     .free = tcache_allocator_free,
+                     .ctx = tcache};
+  return alloc;
+}
+
+#define CONCURRENT_POOL_NIL UINT32_MAX
+#define CONCURRENT_POOL_STASH_CAPACITY 64
+
+typedef struct concurrent_pool_allocator {
+  uint8_t* buffer;
+  size_t chunk_size;
+  size_t chunk_count;
+  ALLOC_ATOMIC(uint64_t) head;
+} concurrent_pool_allocator;
+
+typedef struct concurrent_pool_stash {
+  concurrent_pool_allocator* pool;
+  size_t count;
+  size_t batch_size;
+  void* slots[CONCURRENT_POOL_STASH_CAPACITY];
+} concurrent_pool_stash;
+
+static inline ALLOC_ATOMIC(uint32_t) *
+    concurrent_pool_link(concurrent_pool_allocator* pool, uint32_t index) {
+  return (ALLOC_ATOMIC(uint32_t)*)(pool->buffer + index * pool->chunk_size);
+}
+
+static inline uint32_t concurrent_pool_index(concurrent_pool_allocator* pool,
+                                             void* ptr) {
+  return (uint32_t)(((uint8_t*)ptr - pool->buffer) / pool->chunk_size);
+}
+
+static size_t concurrent_pool_pop(concurrent_pool_allocator* pool,
+                                  size_t max_count, uint32_t* first) {
+  uint64_t head = atomic_load_explicit(&pool->head, memory_order_acquire);
+
+  for (;;) {
+    uint32_t index = (uint32_t)head;
+    size_t count = 0;
+
+    if (index == CONCURRENT_POOL_NIL) {
+      return 0;
+    }
+
+    uint32_t next = index;
+    while (count < max_count && next < pool->chunk_count) {
+      next = atomic_load_explicit(concurrent_pool_link(pool, next),
+                                  memory_order_relaxed);
+      count++;
+    }
+
+    if (next != CONCURRENT_POOL_NIL && next >= pool->chunk_count) {
+      head = atomic_load_explicit(&pool->head, memory_order_acquire);
+      continue;
+    }
+
+    uint64_t new_head = (((head >> 32) + 1) << 32) | next;
+
+    if (atomic_compare_exchange_weak_explicit(&pool->head, &head, new_head,
+                                              memory_order_acquire,
+                                              memory_order_acquire)) {
+      *first = index;
+      return count;
+    }
+  }
+}
+
+static void concurrent_pool_push(concurrent_pool_allocator* pool,
+                                 uint32_t first, uint32_t last) {
+  uint64_t head = atomic_load_explicit(&pool->head, memory_order_relaxed);
+  uint64_t new_head;
+
+  do {
+    atomic_store_explicit(concurrent_pool_link(pool, last), (uint32_t)head,
+                          memory_order_relaxed);
+    new_head = (((head >> 32) + 1) << 32) | first;
+  } while (!atomic_compare_exchange_weak_explicit(&pool->head, &head, new_head,
+                                                  memory_order_release,
+                                                  memory_order_relaxed));
+}
+
+static void* concurrent_pool_allocator_alloc(allocator* self, size_t size,
+                                             size_t alignment) {
+  concurrent_pool_allocator* pool = (concurrent_pool_allocator*)self->ctx;
+  (void)alignment;
+
+  if (size > pool->chunk_size) {
+    return NULL;
+  }
+
+  uint32_t index;
+  if (!concurrent_pool_pop(pool, 1, &index)) {
+    return NULL;
+  }
+
+  return pool->buffer + index * pool->chunk_size;
+}
+
+static size_t concurrent_pool_allocator_alloc_batch(allocator* self,
+                                                    size_t size,
+                                                    size_t alignment,
+                                                    void** out, size_t count) {
+  concurrent_pool_allocator* pool = (concurrent_pool_allocator*)self->ctx;
+  (void)alignment;
+
+  if (size > pool->chunk_size) {
+    return 0;
+  }
+
+  uint32_t index;
+  size_t popped = concurrent_pool_pop(pool, count, &index);
+
+  for (size_t i = 0; i < popped; i++) {
+    out[i] = pool->buffer + index * pool->chunk_size;
+    index = atomic_load_explicit(concurrent_pool_link(pool, index),
+                                 memory_order_relaxed);
+  }
+
+  return popped;
+}
+
+static void concurrent_pool_allocator_free_batch(allocator* self, void** ptrs,
+                                                 size_t size, size_t count) {
+  concurrent_pool_allocator* pool = (concurrent_pool_allocator*)self->ctx;
+  (void)size;
+
+  size_t i = 0;
+  while (i < count && !ptrs[i]) {
+    i++;
+  }
+
+  if (i == count) {
+    return;
+  }
+
+  uint32_t first = concurrent_pool_index(pool, ptrs[i]);
+  uint32_t prev = first;
+
+  for (i++; i < count; i++) {
+    if (!ptrs[i])
+      continue;
+
+    uint32_t index = concurrent_pool_index(pool, ptrs[i]);
+    atomic_store_explicit(concurrent_pool_link(pool, prev), index,
+                          memory_order_relaxed);
+    prev = index;
+  }
+
+  concurrent_pool_push(pool, first, prev);
+}
+
+static void concurrent_pool_allocator_free(allocator* self, void* ptr,
+                                           size_t size);
+
+static void* concurrent_pool_allocator_realloc(allocator* self, void* ptr,
+                                               size_t old_size,
+                                               size_t new_size,
+                                               size_t alignment) {
+  concurrent_pool_allocator* pool = (concurrent_pool_allocator*)self->ctx;
+
+  if (new_size <= pool->chunk_size && old_size <= pool->chunk_size) {
+    return ptr;
+  }
+
+  void* new_ptr = concurrent_pool_allocator_alloc(self, new_size, alignment);
+
+  if (new_ptr && ptr) {
+    memcpy(new_ptr, ptr, old_size < new_size ? old_size : new_size);
+    concurrent_pool_allocator_free(self, ptr, old_size);
+  }
+
+  return new_ptr;
+}
+
+static void concurrent_pool_allocator_free(allocator* self, void* ptr,
+                                           size_t size) {
+  concurrent_pool_allocator* pool = (concurrent_pool_allocator*)self->ctx;
+  (void)size;
+
+  if (!ptr)
+    return;
+
+  uint32_t index = concurrent_pool_index(pool, ptr);
+  concurrent_pool_push(pool, index, index);
+}
+
+static void concurrent_pool_allocator_init(concurrent_pool_allocator* pool,
+                                           void* buffer, size_t chunk_size,
+                                           size_t chunk_count) {
+  assert(chunk_size >= sizeof(uint32_t) && chunk_size % sizeof(uint32_t) == 0);
+  assert(chunk_count < CONCURRENT_POOL_NIL);
+
+  pool->buffer = (uint8_t*)buffer;
+  pool->chunk_size = chunk_size;
+  pool->chunk_count = chunk_count;
+
+  for (size_t i = 0; i < chunk_count; i++) {
+    uint32_t next =
+        i + 1 < chunk_count ? (uint32_t)(i + 1) : CONCURRENT_POOL_NIL;
+    atomic_store_explicit(concurrent_pool_link(pool, (uint32_t)i), next,
+                          memory_order_relaxed);
+  }
+
+  atomic_init(&pool->head, chunk_count ? (uint64_t)0 : CONCURRENT_POOL_NIL);
+}
+
+static allocator concurrent_pool_allocator_get(
+    concurrent_pool_allocator* pool) {
+  allocator alloc = {.alloc = concurrent_pool_allocator_alloc,
+                     .realloc = concurrent_pool_allocator_realloc,
+                     .free = concurrent_pool_allocator_free,
+                     .ctx = pool,
+                     .alloc_batch = concurrent_pool_allocator_alloc_batch,
+                     .free_batch = concurrent_pool_allocator_free_batch};
+  return alloc;
+}
+
+static void concurrent_pool_stash_flush_to(concurrent_pool_stash* stash,
+                                           size_t keep) {
+  concurrent_pool_allocator* pool = stash->pool;
+
+  if (stash->count <= keep) {
+    return;
+  }
+
+  uint32_t first = concurrent_pool_index(pool, stash->slots[keep]);
+  uint32_t prev = first;
+
+  for (size_t i = keep + 1; i < stash->count; i++) {
+    uint32_t index = concurrent_pool_index(pool, stash->slots[i]);
+    atomic_store_explicit(concurrent_pool_link(pool, prev), index,
+                          memory_order_relaxed);
+    prev = index;
+  }
+
+  concurrent_pool_push(pool, first, prev);
+  stash->count = keep;
+}
+
+static void* concurrent_pool_stash_alloc(allocator* self, size_t size,
+                                         size_t alignment) {
+  concurrent_pool_stash* stash = (concurrent_pool_stash*)self->ctx;
+  concurrent_pool_allocator* pool = stash->pool;
+  (void)alignment;
+
+  if (size > pool->chunk_size) {
+    return NULL;
+  }
+
+  if (stash->count == 0) {
+    uint32_t index;
+    size_t count = concurrent_pool_pop(pool, stash->batch_size, &index);
+
+    for (size_t i = 0; i < count; i++) {
+      stash->slots[count - 1 - i] = pool->buffer + index * pool->chunk_size;
+      index = atomic_load_explicit(concurrent_pool_link(pool, index),
+                                   memory_order_relaxed);
+    }
+
+    stash->count = count;
+
+    if (count == 0) {
+      return NULL;
+    }
+  }
+
+  return stash->slots[--stash->count];
+}
+
+static void concurrent_pool_stash_free(allocator* self, void* ptr,
+                                       size_t size);
+
+static void* concurrent_pool_stash_realloc(allocator* self, void* ptr,
+                                           size_t old_size, size_t new_size,
+                                           size_t alignment) {
+  concurrent_pool_stash* stash = (concurrent_pool_stash*)self->ctx;
+
+  if (new_size <= stash->pool->chunk_size &&
+      old_size <= stash->pool->chunk_size) {
+    return ptr;
+  }
+
+  void* new_ptr = concurrent_pool_stash_alloc(self, new_size, alignment);
+
+  if (new_ptr && ptr) {
+    memcpy(new_ptr, ptr, old_size < new_size ? old_size : new_size);
+    concurrent_pool_stash_free(self, ptr, old_size);
+  }
+
+  return new_ptr;
+}
+
+static void concurrent_pool_stash_free(allocator* self, void* ptr,
+                                       size_t size) {
+  concurrent_pool_stash* stash = (concurrent_pool_stash*)self->ctx;
+  (void)size;
+
+  if (!ptr)
+    return;
+
+  if (stash->count == CONCURRENT_POOL_STASH_CAPACITY) {
+    concurrent_pool_stash_flush_to(
+        stash, CONCURRENT_POOL_STASH_CAPACITY - stash->batch_size);
+  }
+
+  stash->slots[stash->count++] = ptr;
+}
+
+static void concurrent_pool_stash_init(concurrent_pool_stash* stash,
+                                       concurrent_pool_allocator* pool) {
+  stash->pool = pool;
+  stash->count = 0;
+  stash->batch_size = CONCURRENT_POOL_STASH_CAPACITY / 2;
+}
+
+static void concurrent_pool_stash_flush(concurrent_pool_stash* stash) {
+  concurrent_pool_stash_flush_to(stash, 0);
+}
+
+static allocator concurrent_pool_stash_get(concurrent_pool_stash* stash) {
+  allocator alloc = {.alloc = concurrent_pool_stash_alloc,
+                     .realloc = concurrent_pool_stash_realloc,
+                     .free = concurrent_pool_stash_free,
+                     .ctx = stash};
+  return alloc;
+}
+
+#define SLAB_MAX_CLASSES 64
+#define SLAB_MAX_SIZE ((size_t)8192)
+#define SLAB_DEFAULT_SLAB_SIZE ((size_t)64 * 1024)
+
+static const size_t slab_default_classes[] = {
+    8,    16,   32,   48,   64,   80,   96,   112,  128,  160,
+    192,  224,  256,  320,  384,  448,  512,  640,  768,  896,
+    1024, 1280, 1536, 1792, 2048, 2560, 3072, 3584, 4096};
+
+typedef struct slab_header slab_header;
+
+struct slab_header {
+  pool_allocator pool;
+  slab_header* prev;
+  slab_header* next;
+  size_t live;
+  size_t size_class;
+  void* owner;
+};
+
+typedef struct slab_class {
+  size_t size;
+  size_t alignment;
+  slab_header* partial;
+  slab_header* full;
+} slab_class;
+
+typedef struct slab_allocator {
+  allocator* backing;
+  size_t slab_size;
+  size_t class_count;
+  size_t max_size;
+  slab_class classes[SLAB_MAX_CLASSES];
+  uint8_t lookup[SLAB_MAX_SIZE / 8 + 1];
+  void* owner;
+} slab_allocator;
+
+static inline void slab_list_remove(slab_header** list, slab_header* slab) {
+  if (slab->prev) {
+    slab->prev->next = slab->next;
+  } else {
+    *list = slab->next;
+  }
+
+  if (slab->next) {
+    slab->next->prev = slab->prev;
+  }
+}
+
+static inline void slab_list_push(slab_header** list, slab_header* slab) {
+  slab->prev = NULL;
+  slab->next = *list;
+  if (*list) {
+    (*list)->prev = slab;
+  }
+  *list = slab;
+}
+
+static inline slab_header* slab_allocator_slab_of(slab_allocator* slab,
+                                                  void* ptr) {
+  return (slab_header*)((uintptr_t)ptr & ~(uintptr_t)(slab->slab_size - 1));
+}
+
+/* Small requests aligned beyond every class go to the backing allocator
+ * aligned to the slab size. Slab chunks never start there, so such blocks
+ * are recognised by address. */
+static inline int slab_allocator_is_direct(slab_allocator* slab, void* ptr,
+                                           size_t size) {
+  return size > slab->max_size ||
+         ((uintptr_t)ptr & (slab->slab_size - 1)) == 0;
+}
+
+static slab_header* slab_allocator_new_slab(slab_allocator* slab,
+                                            size_t size_class) {
+  slab_class* cls = &slab->classes[size_class];
+  slab_header* header = (slab_header*)alloc_alloc(
+      slab->backing, slab->slab_size, slab->slab_size);
+
+  if (!header) {
+    return NULL;
+  }
+
+  uintptr_t start = align_forward((uintptr_t)(header + 1), cls->alignment);
+  size_t chunk_count =
+      ((uintptr_t)header + slab->slab_size - start) / cls->size;
+
+  pool_allocator_init_aligned(&header->pool, (void*)start, cls->size,
+                              chunk_count, cls->alignment);
+  header->live = 0;
+  header->size_class = size_class;
+  header->owner = slab->owner;
+  slab_list_push(&cls->partial, header);
+
+  return header;
+}
+
+static void* slab_allocator_alloc(allocator* self, size_t size,
+                                  size_t alignment) {
+  slab_allocator* slab = (slab_allocator*)self->ctx;
+
+  if (size > slab->max_size) {
+    return alloc_alloc(slab->backing, size, alignment);
+  }
+
+  size_t size_class = slab->lookup[(size + 7) >> 3];
+  while (size_class < slab->class_count &&
+         slab->classes[size_class].alignment < alignment) {
+    size_class++;
+  }
+
+  if (size_class >= slab->class_count) {
+    return alloc_alloc(slab->backing, size,
+                       alignment > slab->slab_size ? alignment
+                                                   : slab->slab_size);
+  }
+
+  slab_class* cls = &slab->classes[size_class];
+  slab_header* header = cls->partial;
+
+  if (!header) {
+    header = slab_allocator_new_slab(slab, size_class);
+    if (!header) {
+      return NULL;
+    }
+  }
+
+  allocator pool = pool_allocator_get(&header->pool);
+  void* ptr = pool_allocator_alloc(&pool, cls->size, cls->alignment);
+
+  header->live++;
+  if (pool_allocator_exhausted(&header->pool)) {
+    slab_list_remove(&cls->partial, header);
+    slab_list_push(&cls->full, header);
+  }
+
+  return ptr;
+}
+
+static void slab_allocator_free(allocator* self, void* ptr, size_t size);
+
+static void* slab_allocator_realloc(allocator* self, void* ptr,
+                                    size_t old_size, size_t new_size,
+                                    size_t alignment) {
+  slab_allocator* slab = (slab_allocator*)self->ctx;
+
+  if (!ptr) {
+    return slab_allocator_alloc(self, new_size, alignment);
+  }
+
+  if (old_size > slab->max_size && new_size > slab->max_size) {
+    return alloc_realloc(slab->backing, ptr, old_size, new_size, alignment);
+  }
+
+  if (!slab_allocator_is_direct(slab, ptr, old_size) &&
+      new_size <= slab->max_size) {
+    slab_header* header = slab_allocator_slab_of(slab, ptr);
+    slab_class* cls = &slab->classes[header->size_class];
+
+    if (new_size <= cls->size && ((uintptr_t)ptr & (alignment - 1)) == 0) {
+      return ptr;
+    }
+  }
+
+  void* new_ptr = slab_allocator_alloc(self, new_size, alignment);
+
+  if (new_ptr) {
+    memcpy(new_ptr, ptr, old_size < new_size ? old_size : new_size);
+    slab_allocator_free(self, ptr, old_size);
+  }
+
+  return new_ptr;
+}
+
+static void slab_allocator_free(allocator* self, void* ptr, size_t size) {
+  slab_allocator* slab = (slab_allocator*)self->ctx;
+
+  if (!ptr)
+    return;
+
+  if (slab_allocator_is_direct(slab, ptr, size)) {
+    alloc_free(slab->backing, ptr, size);
+    return;
+  }
+
+  slab_header* header = slab_allocator_slab_of(slab, ptr);
+  slab_class* cls = &slab->classes[header->size_class];
+
+  if (pool_allocator_exhausted(&header->pool)) {
+    slab_list_remove(&cls->full, header);
+    slab_list_push(&cls->partial, header);
+  }
+
+  allocator pool = pool_allocator_get(&header->pool);
+  pool_allocator_free(&pool, ptr, cls->size);
+  header->live--;
+
+  if (header->live == 0 && (header->prev || header->next)) {
+    slab_list_remove(&cls->partial, header);
+    ALLOC_ASAN_UNPOISON(header, slab->slab_size);
+    alloc_free(slab->backing, header, slab->slab_size);
+  }
+}
+
+static void slab_allocator_init(slab_allocator* slab, allocator* backing,
+                                const size_t* class_sizes, size_t class_count,
+                                size_t slab_size) {
+  if (!class_sizes) {
+    class_sizes = slab_default_classes;
+    class_count =
+        sizeof(slab_default_classes) / sizeof(slab_default_classes[0]);
+  }
+
+  assert(class_count > 0 && class_count <= SLAB_MAX_CLASSES);
+  assert(class_sizes[class_count - 1] <= SLAB_MAX_SIZE);
+
+  slab->backing = backing;
+  slab->owner = NULL;
+  slab->slab_size = slab_size ? slab_size : SLAB_DEFAULT_SLAB_SIZE;
+  slab->class_count = class_count;
+  slab->max_size = class_sizes[class_count - 1];
+
+  assert((slab->slab_size & (slab->slab_size - 1)) == 0);
+  assert(slab->slab_size >= 2 * slab->max_size + sizeof(slab_header));
+
+  for (size_t i = 0; i < class_count; i++) {
+    size_t class_size = align_forward(class_sizes[i], sizeof(void*));
+    slab->classes[i].size = class_size;
+    slab->classes[i].alignment = class_size & (~class_size + 1);
+    slab->classes[i].partial = NULL;
+    slab->classes[i].full = NULL;
+  }
+
+  size_t size_class = 0;
+  for (size_t i = 0; i <= slab->max_size >> 3; i++) {
+    while ((i << 3) > slab->classes[size_class].size) {
+      size_class++;
+    }
+    slab->lookup[i] = (uint8_t)size_class;
+  }
+}
+
+static void slab_allocator_destroy(slab_allocator* slab) {
+  for (size_t i = 0; i < slab->class_count; i++) {
+    slab_header** lists[2] = {&slab->classes[i].partial,
+                              &slab->classes[i].full};
+
+    for (int j = 0; j < 2; j++) {
+      while (*lists[j]) {
+        slab_header* header = *lists[j];
+        *lists[j] = header->next;
+        ALLOC_ASAN_UNPOISON(header, slab->slab_size);
+        alloc_free(slab->backing, header, slab->slab_size);
+      }
+    }
+  }
+}
+
+static allocator slab_allocator_get(slab_allocator* slab) {
+  allocator alloc = {.alloc = slab_allocator_alloc,
+                     .realloc = slab_allocator_realloc,
+                     .free = slab_allocator_free,
+                     .ctx = slab};
+  return alloc;
+}
+
+typedef struct heap_allocator heap_allocator;
+typedef struct thread_heap thread_heap;
+
+struct thread_heap {
+  slab_allocator slab;
+  ALLOC_ATOMIC(uintptr_t) remote_free;
+  heap_allocator* parent;
+  thread_heap* next;
+  size_t live;
+  int abandoned;
+};
+
+struct heap_allocator {
+  allocator* backing;
+  allocator locked_backing;
+  alloc_mutex lock;
+  alloc_tls_key key;
+  size_t slab_size;
+  size_t max_size;
+  size_t max_alignment;
+  thread_heap* heaps;
+};
+
+/* Slab chunks never start on a slab boundary, where the header sits, so
+ * blocks the backing aligns to one are told apart by address alone. */
+static inline int heap_allocator_is_direct(heap_allocator* heap, void* ptr,
+                                           size_t size) {
+  return size > heap->max_size ||
+         ((uintptr_t)ptr & (heap->slab_size - 1)) == 0;
+}
+
+static void* heap_allocator_backing_alloc(allocator* self, size_t size,
+                                          size_t alignment) {
+  heap_allocator* heap = (heap_allocator*)self->ctx;
+  alloc_mutex_lock(&heap->lock);
+  void* ptr = alloc_alloc(heap->backing, size, alignment);
+  alloc_mutex_unlock(&heap->lock);
+  return ptr;
+}
+
+static void* heap_allocator_backing_realloc(allocator* self, void* ptr,
+                                            size_t old_size, size_t new_size,
+                                            size_t alignment) {
+  heap_allocator* heap = (heap_allocator*)self->ctx;
+  alloc_mutex_lock(&heap->lock);
+  void* new_ptr =
+      alloc_realloc(heap->backing, ptr, old_size, new_size, alignment);
+  alloc_mutex_unlock(&heap->lock);
+  return new_ptr;
+}
+
+static void heap_allocator_backing_free(allocator* self, void* ptr,
+                                        size_t size) {
+  heap_allocator* heap = (heap_allocator*)self->ctx;
+  alloc_mutex_lock(&heap->lock);
+  alloc_free(heap->backing, ptr, size);
+  alloc_mutex_unlock(&heap->lock);
+}
+
+static void thread_heap_drain(thread_heap* local) {
+  uintptr_t node = atomic_exchange_explicit(&local->remote_free, (uintptr_t)0,
+                                            memory_order_acquire);
+  allocator slab = slab_allocator_get(&local->slab);
+
+  while (node) {
+    uintptr_t next = *(uintptr_t*)node;
+    slab_allocator_free(&slab, (void*)node, 0);
+    local->live--;
+    node = next;
+  }
+}
+
+static void thread_heap_push_remote(thread_heap* owner, void* ptr) {
+  uintptr_t head =
+      atomic_load_explicit(&owner->remote_free, memory_order_relaxed);
+
+  do {
+    *(uintptr_t*)ptr = head;
+  } while (!atomic_compare_exchange_weak_explicit(
+      &owner->remote_free, &head, (uintptr_t)ptr, memory_order_release,
+      memory_order_relaxed));
+}
+
+static void heap_allocator_unlink(heap_allocator* heap, thread_heap* local) {
+  thread_heap** link = &heap->heaps;
+
+  while (*link != local) {
+    link = &(*link)->next;
+  }
+
+  *link = local->next;
+}
+
+static void heap_allocator_release(heap_allocator* heap, thread_heap* local) {
+  slab_allocator_destroy(&local->slab);
+  alloc_free(&heap->locked_backing, local, sizeof(thread_heap));
+}
+
+static void heap_allocator_thread_exit(void* value) {
+  thread_heap* local = (thread_heap*)value;
+
+  if (!local) {
+    return;
+  }
+
+  heap_allocator* heap = local->parent;
+  thread_heap_drain(local);
+
+  int release = local->live == 0 && !atomic_load_explicit(
+                                         &local->remote_free,
+                                         memory_order_acquire);
+
+  alloc_mutex_lock(&heap->lock);
+  if (release) {
+    heap_allocator_unlink(heap, local);
+  } else {
+    local->abandoned = 1;
+  }
+  alloc_mutex_unlock(&heap->lock);
+
+  if (release) {
+    heap_allocator_release(heap, local);
+  }
+}
+
+static thread_heap* heap_allocator_local(heap_allocator* heap) {
+  thread_heap* local = (thread_heap*)alloc_tls_get(heap->key);
+
+  if (local) {
+    return local;
+  }
+
+  alloc_mutex_lock(&heap->lock);
+
+  for (thread_heap* it = heap->heaps; it; it = it->next) {
+    if (it->abandoned) {
+      it->abandoned = 0;
+      local = it;
+      break;
+    }
+  }
+
+  alloc_mutex_unlock(&heap->lock);
+
+  if (!local) {
+    local = (thread_heap*)alloc_alloc(&heap->locked_backing,
+                                      sizeof(thread_heap), sizeof(void*));
+
+    if (!local) {
+      return NULL;
+    }
+
+    slab_allocator_init(&local->slab, &heap->locked_backing, NULL, 0,
+                        heap->slab_size);
+    local->slab.owner = local;
+    atomic_init(&local->remote_free, (uintptr_t)0);
+    local->parent = heap;
+    local->live = 0;
+    local->abandoned = 0;
+
+    alloc_mutex_lock(&heap->lock);
+    local->next = heap->heaps;
+    heap->heaps = local;
+    alloc_mutex_unlock(&heap->lock);
+  }
+
+  if (local) {
+    alloc_tls_set(heap->key, local);
+  }
+
+  return local;
+}
+
+static void* heap_allocator_alloc(allocator* self, size_t size,
+                                  size_t alignment) {
+  heap_allocator* heap = (heap_allocator*)self->ctx;
+
+  /* Direct requests never touch the slabs, so threads that only make them
+   * get no heap and no TLS destructor. */
+  if (size > heap->max_size) {
+    return alloc_alloc(&heap->locked_backing, size, alignment);
+  }
+
+  if (alignment > heap->max_alignment) {
+    return alloc_alloc(&heap->locked_backing, size,
+                       alignment > heap->slab_size ? alignment
+                                                   : heap->slab_size);
+  }
+
+  thread_heap* local = heap_allocator_local(heap);
+
+  if (!local) {
+    return NULL;
+  }
+
+  if (atomic_load_explicit(&local->remote_free, memory_order_relaxed)) {
+    thread_heap_drain(local);
+  }
+
+  allocator slab = slab_allocator_get(&local->slab);
+  void* ptr = slab_allocator_alloc(&slab, size, alignment);
+
+  if (ptr) {
+    local->live++;
+  }
+
+  return ptr;
+}
+
+static void heap_allocator_free(allocator* self, void* ptr, size_t size) {
+  heap_allocator* heap = (heap_allocator*)self->ctx;
+
+  if (!ptr)
+    return;
+
+  thread_heap* local = (thread_heap*)alloc_tls_get(heap->key);
+
+  if (heap_allocator_is_direct(heap, ptr, size)) {
+    alloc_free(&heap->locked_backing, ptr, size);
+    return;
+  }
+
+  slab_header* header =
+      (slab_header*)((uintptr_t)ptr & ~(uintptr_t)(heap->slab_size - 1));
+  thread_heap* owner = (thread_heap*)header->owner;
+
+  if (owner == local) {
+    allocator slab = slab_allocator_get(&local->slab);
+    slab_allocator_free(&slab, ptr, size);
+    local->live--;
+  } else {
+    thread_heap_push_remote(owner, ptr);
+  }
+}
+
+static void* heap_allocator_realloc(allocator* self, void* ptr,
+                                    size_t old_size, size_t new_size,
+                                    size_t alignment) {
+  heap_allocator* heap = (heap_allocator*)self->ctx;
+
+  if (!ptr) {
+    return heap_allocator_alloc(self, new_size, alignment);
+  }
+
+  if (old_size > heap->max_size && new_size > heap->max_size) {
+    return alloc_realloc(&heap->locked_backing, ptr, old_size, new_size,
+                         alignment);
+  }
+
+  if (!heap_allocator_is_direct(heap, ptr, old_size) &&
+      new_size <= heap->max_size && ((uintptr_t)ptr & (alignment - 1)) == 0) {
+    slab_header* header =
+        (slab_header*)((uintptr_t)ptr & ~(uintptr_t)(heap->slab_size - 1));
+    if (new_size <= header->pool.chunk_size) {
+      return ptr;
+    }
+  }
+
+  void* new_ptr = heap_allocator_alloc(self, new_size, alignment);
+
+  if (new_ptr) {
+    memcpy(new_ptr, ptr, old_size < new_size ? old_size : new_size);
+    heap_allocator_free(self, ptr, old_size);
+  }
+
+  return new_ptr;
+}
+
+static void heap_allocator_init(heap_allocator* heap, allocator* backing) {
+  heap->backing = backing;
+  heap->slab_size = SLAB_DEFAULT_SLAB_SIZE;
+  heap->max_size = slab_default_classes[sizeof(slab_default_classes) /
+                                            sizeof(slab_default_classes[0]) -
+                                        1];
+  heap->max_alignment = 0;
+  for (size_t i = 0;
+       i < sizeof(slab_default_classes) / sizeof(slab_default_classes[0]);
+       i++) {
+    size_t class_size = slab_default_classes[i];
+    if ((class_size & (~class_size + 1)) > heap->max_alignment) {
+      heap->max_alignment = class_size & (~class_size + 1);
+    }
+  }
+  heap->heaps = NULL;
+  alloc_mutex_init(&heap->lock);
+  alloc_tls_create(&heap->key, heap_allocator_thread_exit);
+
+  allocator locked = {.alloc = heap_allocator_backing_alloc,
+                      .realloc = heap_allocator_backing_realloc,
+                      .free = heap_allocator_backing_free,
+                      .ctx = heap};
+  heap->locked_backing = locked;
+}
+
+static void heap_allocator_destroy(heap_allocator* heap) {
+  alloc_tls_set(heap->key, NULL);
+
+  while (heap->heaps) {
+    thread_heap* local = heap->heaps;
+    heap_allocator_unlink(heap, local);
+    heap_allocator_release(heap, local);
+  }
+
+  alloc_tls_delete(heap->key);
+  alloc_mutex_destroy(&heap->lock);
+}
+
+static allocator heap_allocator_get(heap_allocator* heap) {
+  allocator alloc = {.alloc = heap_allocator_alloc,
+                     .realloc = heap_allocator_realloc,
+                     .free = heap_allocator_free,
+                     .ctx = heap};
+  return alloc;
+}
+
+#define STATS_SIZE_BUCKETS 32
+#define STATS_ALIGNMENT_BUCKETS 16
+
+typedef struct stats_snapshot {
+  uint64_t allocs;
+  uint64_t frees;
+  uint64_t reallocs;
+  uint64_t failed;
+  uint64_t live_bytes;
+  uint64_t peak_bytes;
+  uint64_t total_bytes;
+  uint64_t total_alignment;
+  uint64_t size_histogram[STATS_SIZE_BUCKETS];
+  uint64_t alignment_histogram[STATS_ALIGNMENT_BUCKETS];
+} stats_snapshot;
+
+typedef struct stats_allocator {
+  allocator* backing;
+  ALLOC_ATOMIC(uint64_t) allocs;
+  ALLOC_ATOMIC(uint64_t) frees;
+  ALLOC_ATOMIC(uint64_t) reallocs;
+  ALLOC_ATOMIC(uint64_t) failed;
+  ALLOC_ATOMIC(uint64_t) live_bytes;
+  ALLOC_ATOMIC(uint64_t) peak_bytes;
+  ALLOC_ATOMIC(uint64_t) total_bytes;
+  ALLOC_ATOMIC(uint64_t) total_alignment;
+  ALLOC_ATOMIC(uint64_t) size_histogram[STATS_SIZE_BUCKETS];
+  ALLOC_ATOMIC(uint64_t) alignment_histogram[STATS_ALIGNMENT_BUCKETS];
+} stats_allocator;
+
+static inline int stats_bucket(size_t value, int bucket_count) {
+  int bucket = value ? alloc_bit_scan_reverse(value) : 0;
+  return bucket < bucket_count ? bucket : bucket_count - 1;
+}
+
+static void stats_allocator_record_alloc(stats_allocator* stats, size_t size,
+                                         size_t alignment) {
+  atomic_fetch_add_explicit(&stats->total_bytes, size, memory_order_relaxed);
+  atomic_fetch_add_explicit(&stats->total_alignment, alignment,
+                            memory_order_relaxed);
+  atomic_fetch_add_explicit(
+      &stats->size_histogram[stats_bucket(size, STATS_SIZE_BUCKETS)], 1,
+      memory_order_relaxed);
+  atomic_fetch_add_explicit(
+      &stats->alignment_histogram[stats_bucket(alignment,
+                                               STATS_ALIGNMENT_BUCKETS)],
+      1, memory_order_relaxed);
+
+  uint64_t live =
+      atomic_fetch_add_explicit(&stats->live_bytes, size,
+                                memory_order_relaxed) +
+      size;
+  uint64_t peak =
+      atomic_load_explicit(&stats->peak_bytes, memory_order_relaxed);
+
+  while (live > peak &&
+         !atomic_compare_exchange_weak_explicit(&stats->peak_bytes, &peak,
+                                                live, memory_order_relaxed,
+                                                memory_order_relaxed)) {
+  }
+}
+
+static void* stats_allocator_alloc(allocator* self, size_t size,
+                                   size_t alignment) {
+  stats_allocator* stats = (stats_allocator*)self->ctx;
+
+  void* ptr = alloc_alloc(stats->backing, size, alignment);
+
+  if (!ptr) {
+    atomic_fetch_add_explicit(&stats->failed, 1, memory_order_relaxed);
+    return NULL;
+  }
+
+  atomic_fetch_add_explicit(&stats->allocs, 1, memory_order_relaxed);
+  stats_allocator_record_alloc(stats, size, alignment);
+
+  return ptr;
+}
+
+static void* stats_allocator_realloc(allocator* self, void* ptr,
+                                     size_t old_size, size_t new_size,
+                                     size_t alignment) {
+  stats_allocator* stats = (stats_allocator*)self->ctx;
+
+  void* new_ptr =
+      alloc_realloc(stats->backing, ptr, old_size, new_size, alignment);
+
+  if (!new_ptr) {
+    atomic_fetch_add_explicit(&stats->failed, 1, memory_order_relaxed);
+    return NULL;
+  }
+
+  if (!ptr) {
+    atomic_fetch_add_explicit(&stats->allocs, 1, memory_order_relaxed);
+    stats_allocator_record_alloc(stats, new_size, alignment);
+    return new_ptr;
+  }
+
+  atomic_fetch_add_explicit(&stats->reallocs, 1, memory_order_relaxed);
+  atomic_fetch_sub_explicit(&stats->live_bytes, old_size,
+                            memory_order_relaxed);
+  stats_allocator_record_alloc(stats, new_size, alignment);
+
+  return new_ptr;
+}
+
+static void stats_allocator_free(allocator* self, void* ptr, size_t size) {
+  stats_allocator* stats = (stats_allocator*)self->ctx;
+
+  if (!ptr)
+    return;
+
+  atomic_fetch_add_explicit(&stats->frees, 1, memory_order_relaxed);
+  atomic_fetch_sub_explicit(&stats->live_bytes, size, memory_order_relaxed);
+  alloc_free(stats->backing, ptr, size);
+}
+
+static void stats_allocator_init(stats_allocator* stats, allocator* backing) {
+  stats->backing = backing;
+  atomic_init(&stats->allocs, 0);
+  atomic_init(&stats->frees, 0);
+  atomic_init(&stats->reallocs, 0);
+  atomic_init(&stats->failed, 0);
+  atomic_init(&stats->live_bytes, 0);
+  atomic_init(&stats->peak_bytes, 0);
+  atomic_init(&stats->total_bytes, 0);
+  atomic_init(&stats->total_alignment, 0);
+
+  for (int i = 0; i < STATS_SIZE_BUCKETS; i++) {
+    atomic_init(&stats->size_histogram[i], 0);
+  }
+
+  for (int i = 0; i < STATS_ALIGNMENT_BUCKETS; i++) {
+    atomic_init(&stats->alignment_histogram[i], 0);
+  }
+}
+
+static void stats_allocator_snapshot(stats_allocator* stats,
+                                     stats_snapshot* snapshot) {
+  snapshot->allocs =
+      atomic_load_explicit(&stats->allocs, memory_order_relaxed);
+  snapshot->frees = atomic_load_explicit(&stats->frees, memory_order_relaxed);
+  snapshot->reallocs =
+      atomic_load_explicit(&stats->reallocs, memory_order_relaxed);
+  snapshot->failed =
+      atomic_load_explicit(&stats->failed, memory_order_relaxed);
+  snapshot->live_bytes =
+      atomic_load_explicit(&stats->live_bytes, memory_order_relaxed);
+  snapshot->peak_bytes =
+      atomic_load_explicit(&stats->peak_bytes, memory_order_relaxed);
+  snapshot->total_bytes =
+      atomic_load_explicit(&stats->total_bytes, memory_order_relaxed);
+  snapshot->total_alignment =
+      atomic_load_explicit(&stats->total_alignment, memory_order_relaxed);
+
+  for (int i = 0; i < STATS_SIZE_BUCKETS; i++) {
+    snapshot->size_histogram[i] =
+        atomic_load_explicit(&stats->size_histogram[i], memory_order_relaxed);
+  }
+
+  for (int i = 0; i < STATS_ALIGNMENT_BUCKETS; i++) {
+    snapshot->alignment_histogram[i] = atomic_load_explicit(
+        &stats->alignment_histogram[i], memory_order_relaxed);
+  }
+}
+
+static void stats_snapshot_write_histogram(FILE* out, const char* name,
+                                           const char* metric,
+                                           const uint64_t* buckets,
+                                           int bucket_count, uint64_t sum) {
+  uint64_t cumulative = 0;
+
+  fprintf(out, "# TYPE %s_%s histogram\n", name, metric);
+  for (int i = 0; i < bucket_count; i++) {
+    cumulative += buckets[i];
+    if (i + 1 < bucket_count) {
+      fprintf(out, "%s_%s_bucket{le=\"%llu\"} %llu\n", name, metric,
+              (unsigned long long)((2ULL << i) - 1),
+              (unsigned long long)cumulative);
+    }
+  }
+  fprintf(out, "%s_%s_bucket{le=\"+Inf\"} %llu\n", name, metric,
+          (unsigned long long)cumulative);
+  fprintf(out, "%s_%s_sum %llu\n", name, metric, (unsigned long long)sum);
+  fprintf(out, "%s_%s_count %llu\n", name, metric,
+          (unsigned long long)cumulative);
+}
+
+static void stats_snapshot_write_prometheus(const stats_snapshot* snapshot,
+                                            const char* name, FILE* out) {
+  const char* counters[] = {"allocs_total", "frees_total", "reallocs_total",
+                            "failed_total", "allocated_bytes_total"};
+  uint64_t counter_values[] = {snapshot->allocs, snapshot->frees,
+                               snapshot->reallocs, snapshot->failed,
+                               snapshot->total_bytes};
+
+  for (int i = 0; i < 5; i++) {
+    fprintf(out, "# TYPE %s_%s counter\n%s_%s %llu\n", name, counters[i],
+            name, counters[i], (unsigned long long)counter_values[i]);
+  }
+
+  fprintf(out, "# TYPE %s_live_bytes gauge\n%s_live_bytes %llu\n", name,
+          name, (unsigned long long)snapshot->live_bytes);
+  fprintf(out, "# TYPE %s_peak_bytes gauge\n%s_peak_bytes %llu\n", name,
+          name, (unsigned long long)snapshot->peak_bytes);
+
+  stats_snapshot_write_histogram(out, name, "alloc_size",
+                                 snapshot->size_histogram, STATS_SIZE_BUCKETS,
+                                 snapshot->total_bytes);
+  stats_snapshot_write_histogram(
+      out, name, "alloc_alignment", snapshot->alignment_histogram,
+      STATS_ALIGNMENT_BUCKETS, snapshot->total_alignment);
+}
+
+static void freelist_latency_write_prometheus(const freelist_latency* latency,
+                                              const char* name, FILE* out) {
+  stats_snapshot_write_histogram(out, name, "alloc_cycles",
+                                 latency->alloc_cycles,
+                                 FREELIST_LATENCY_BUCKETS, latency->alloc_sum);
+  stats_snapshot_write_histogram(out, name, "free_cycles",
+                                 latency->free_cycles,
+                                 FREELIST_LATENCY_BUCKETS, latency->free_sum);
+  fprintf(out, "# TYPE %s_alloc_cycles_max gauge\n%s_alloc_cycles_max %llu\n",
+          name, name, (unsigned long long)latency->alloc_max);
+  fprintf(out, "# TYPE %s_free_cycles_max gauge\n%s_free_cycles_max %llu\n",
+          name, name, (unsigned long long)latency->free_max);
+}
+
+static allocator stats_allocator_get(stats_allocator* stats) {
+  allocator alloc = {.alloc = stats_allocator_alloc,
+                     .realloc = stats_allocator_realloc,
+                     .free = stats_allocator_free,
+                     .ctx = stats};
+  return alloc;
+}
 
-  void** free_node = (void**)ptr;
-  *free_node = pool->free_list;
-  pool->free_list = free_node;
+#define PROFILE_MAX_DEPTH 32
+#define PROFILE_DEFAULT_INTERVAL ((size_t)512 * 1024)
+#define PROFILE_KEY_EMPTY ((uintptr_t)0)
+#define PROFILE_KEY_DELETED ((uintptr_t)1)
+/* Freed samples leave tombstones that lock-free lookups must step over, so
+ * probes stop after this many slots; a sample that finds no free slot
+ * within it is counted in dropped_samples instead. */
+#define PROFILE_MAX_PROBE 16
+
+typedef struct profile_sample {
+  size_t size;
+  int depth;
+  void* stack[PROFILE_MAX_DEPTH];
+} profile_sample;
+
+typedef struct profile_allocator {
+  allocator* backing;
+  size_t sample_interval;
+  alloc_mutex lock;
+  size_t capacity;
+  ALLOC_ATOMIC(uintptr_t) * keys;
+  profile_sample* samples;
+  ALLOC_ATOMIC(size_t) live_samples;
+  size_t dropped_samples;
+} profile_allocator;
+
+static ALLOC_THREAD_LOCAL int64_t profile_bytes_until_sample;
+static ALLOC_THREAD_LOCAL uint64_t profile_rng_state;
+
+static inline double alloc_fast_log2(double x) {
+  uint64_t bits;
+  memcpy(&bits, &x, sizeof(bits));
+
+  int exponent = (int)((bits >> 52) & 0x7ff) - 1023;
+  bits = (bits & 0x000fffffffffffffULL) | 0x3ff0000000000000ULL;
+
+  double mantissa;
+  memcpy(&mantissa, &bits, sizeof(mantissa));
+
+  return exponent - 1 + (-0.34484843 * mantissa + 2.02466578) * mantissa -
+         0.67487759;
+}
+
+static int64_t profile_next_interval(size_t mean) {
+  if (profile_rng_state == 0) {
+    profile_rng_state = (uint64_t)(uintptr_t)&profile_rng_state | 1;
+  }
+
+  profile_rng_state ^= profile_rng_state << 13;
+  profile_rng_state ^= profile_rng_state >> 7;
+  profile_rng_state ^= profile_rng_state << 17;
+
+  double u = ((double)(profile_rng_state >> 11) + 1.0) / 9007199254740993.0;
+  double interval = -alloc_fast_log2(u) * 0.6931471805599453 * (double)mean;
+
+  return (int64_t)interval + 1;
+}
+
+static inline size_t profile_slot(profile_allocator* prof, void* ptr) {
+  uint64_t hash = ((uint64_t)(uintptr_t)ptr >> 4) * 0x9e3779b97f4a7c15ULL;
+  return (size_t)(hash >> 32) & (prof->capacity - 1);
+}
+
+static inline size_t profile_probe_limit(profile_allocator* prof) {
+  return prof->capacity < PROFILE_MAX_PROBE ? prof->capacity
+                                            : PROFILE_MAX_PROBE;
+}
+
+static size_t profile_allocator_find(profile_allocator* prof, void* ptr) {
+  size_t slot = profile_slot(prof, ptr);
+  size_t limit = profile_probe_limit(prof);
+
+  for (size_t i = 0; i < limit; i++) {
+    uintptr_t key =
+        atomic_load_explicit(&prof->keys[slot], memory_order_acquire);
+
+    if (key == (uintptr_t)ptr) {
+      return slot;
+    }
+
+    if (key == PROFILE_KEY_EMPTY) {
+      break;
+    }
+
+    slot = (slot + 1) & (prof->capacity - 1);
+  }
+
+  return prof->capacity;
+}
+
+static void profile_allocator_insert(profile_allocator* prof, void* ptr,
+                                     const profile_sample* sample) {
+  alloc_mutex_lock(&prof->lock);
+
+  size_t slot = profile_slot(prof, ptr);
+  size_t limit = profile_probe_limit(prof);
+  size_t i = 0;
+
+  for (; i < limit; i++) {
+    uintptr_t key =
+        atomic_load_explicit(&prof->keys[slot], memory_order_relaxed);
+    if (key == PROFILE_KEY_EMPTY || key == PROFILE_KEY_DELETED) {
+      break;
+    }
+    slot = (slot + 1) & (prof->capacity - 1);
+  }
+
+  if (i == limit) {
+    prof->dropped_samples++;
+  } else {
+    profile_sample* slot_sample = &prof->samples[slot];
+    slot_sample->size = sample->size;
+    slot_sample->depth = sample->depth;
+    memcpy(slot_sample->stack, sample->stack,
+           (size_t)sample->depth * sizeof(void*));
+    atomic_store_explicit(&prof->keys[slot], (uintptr_t)ptr,
+                          memory_order_release);
+    atomic_fetch_add_explicit(&prof->live_samples, 1, memory_order_relaxed);
+  }
+
+  alloc_mutex_unlock(&prof->lock);
+}
+
+static void profile_allocator_record(profile_allocator* prof, void* ptr,
+                                     size_t size) {
+  profile_sample sample;
+  sample.size = size;
+  sample.depth = 0;
+
+#if defined(__GLIBC__) || defined(__APPLE__)
+  sample.depth = backtrace(sample.stack, PROFILE_MAX_DEPTH);
+#elif defined(_WIN32)
+  sample.depth =
+      (int)CaptureStackBackTrace(0, PROFILE_MAX_DEPTH, sample.stack, NULL);
+#endif
+
+  profile_allocator_insert(prof, ptr, &sample);
+}
+
+/* Removes the sample for ptr, copying it to out when out is non-NULL.
+ * Returns whether ptr was sampled. */
+static int profile_allocator_take(profile_allocator* prof, void* ptr,
+                                  profile_sample* out) {
+  if (atomic_load_explicit(&prof->live_samples, memory_order_relaxed) == 0 ||
+      profile_allocator_find(prof, ptr) == prof->capacity) {
+    return 0;
+  }
+
+  alloc_mutex_lock(&prof->lock);
+
+  size_t slot = profile_allocator_find(prof, ptr);
+  if (slot != prof->capacity) {
+    if (out) {
+      *out = prof->samples[slot];
+    }
+    atomic_store_explicit(&prof->keys[slot], PROFILE_KEY_DELETED,
+                          memory_order_relaxed);
+    atomic_fetch_sub_explicit(&prof->live_samples, 1, memory_order_relaxed);
+  }
+
+  alloc_mutex_unlock(&prof->lock);
+
+  return slot != prof->capacity;
+}
+
+static void profile_allocator_forget(profile_allocator* prof, void* ptr) {
+  profile_allocator_take(prof, ptr, NULL);
+}
+
+static inline void profile_allocator_account(profile_allocator* prof,
+                                             void* ptr, size_t size) {
+  profile_bytes_until_sample -= (int64_t)size;
+
+  if (profile_bytes_until_sample < 0) {
+    int first = profile_rng_state == 0;
+    profile_bytes_until_sample = profile_next_interval(prof->sample_interval);
+
+    if (!first) {
+      profile_allocator_record(prof, ptr, size);
+    }
+  }
+}
+
+static void* profile_allocator_alloc(allocator* self, size_t size,
+                                     size_t alignment) {
+  profile_allocator* prof = (profile_allocator*)self->ctx;
+
+  void* ptr = alloc_alloc(prof->backing, size, alignment);
+
+  if (ptr) {
+    profile_allocator_account(prof, ptr, size);
+  }
+
+  return ptr;
+}
+
+static void* profile_allocator_realloc(allocator* self, void* ptr,
+                                       size_t old_size, size_t new_size,
+                                       size_t alignment) {
+  profile_allocator* prof = (profile_allocator*)self->ctx;
+
+  /* The sample is lifted out before the call, since once the backing has
+   * released ptr another thread may be handed the same address. It goes
+   * back if the realloc fails and ptr is still live. */
+  profile_sample sample;
+  int sampled = ptr && profile_allocator_take(prof, ptr, &sample);
+
+  void* new_ptr =
+      alloc_realloc(prof->backing, ptr, old_size, new_size, alignment);
+
+  if (new_ptr) {
+    profile_allocator_account(prof, new_ptr, new_size);
+  } else if (sampled) {
+    profile_allocator_insert(prof, ptr, &sample);
+  }
+
+  return new_ptr;
+}
+
+static void profile_allocator_free(allocator* self, void* ptr, size_t size) {
+  profile_allocator* prof = (profile_allocator*)self->ctx;
+
+  if (!ptr)
+    return;
+
+  profile_allocator_forget(prof, ptr);
+  alloc_free(prof->backing, ptr, size);
+}
+
+static int profile_allocator_init(profile_allocator* prof, allocator* backing,
+                                  size_t sample_interval, size_t capacity) {
+  size_t rounded = 16;
+  while (rounded < capacity) {
+    rounded <<= 1;
+  }
+
+  prof->backing = backing;
+  prof->sample_interval =
+      sample_interval ? sample_interval : PROFILE_DEFAULT_INTERVAL;
+  prof->capacity = rounded;
+  prof->dropped_samples = 0;
+  atomic_init(&prof->live_samples, 0);
+  alloc_mutex_init(&prof->lock);
+
+  prof->keys = (ALLOC_ATOMIC(uintptr_t)*)alloc_alloc(
+      backing, rounded * sizeof(*prof->keys), sizeof(void*));
+  prof->samples = (profile_sample*)alloc_alloc(
+      backing, rounded * sizeof(profile_sample), sizeof(void*));
+
+  if (!prof->keys || !prof->samples) {
+    alloc_free(backing, prof->keys, rounded * sizeof(*prof->keys));
+    alloc_free(backing, prof->samples, rounded * sizeof(profile_sample));
+    prof->keys = NULL;
+    prof->samples = NULL;
+    prof->capacity = 0;
+    return 0;
+  }
+
+  for (size_t i = 0; i < rounded; i++) {
+    atomic_init(&prof->keys[i], PROFILE_KEY_EMPTY);
+  }
+
+  return 1;
+}
+
+static void profile_allocator_destroy(profile_allocator* prof) {
+  alloc_free(prof->backing, prof->keys, prof->capacity * sizeof(*prof->keys));
+  alloc_free(prof->backing, prof->samples,
+             prof->capacity * sizeof(profile_sample));
+  alloc_mutex_destroy(&prof->lock);
+  prof->keys = NULL;
+  prof->samples = NULL;
+  prof->capacity = 0;
+}
+
+static void profile_allocator_write_heap_profile(profile_allocator* prof,
+                                                 FILE* out) {
+  alloc_mutex_lock(&prof->lock);
+
+  size_t count = 0;
+  size_t bytes = 0;
+
+  for (size_t i = 0; i < prof->capacity; i++) {
+    uintptr_t key = atomic_load_explicit(&prof->keys[i], memory_order_relaxed);
+    if (key != PROFILE_KEY_EMPTY && key != PROFILE_KEY_DELETED) {
+      count++;
+      bytes += prof->samples[i].size;
+    }
+  }
+
+  fprintf(out, "heap profile: %zu: %zu [%zu: %zu] @ heap_v2/%zu\n", count,
+          bytes, count, bytes, prof->sample_interval);
+
+  for (size_t i = 0; i < prof->capacity; i++) {
+    uintptr_t key = atomic_load_explicit(&prof->keys[i], memory_order_relaxed);
+    if (key == PROFILE_KEY_EMPTY || key == PROFILE_KEY_DELETED) {
+      continue;
+    }
+
+    profile_sample* sample = &prof->samples[i];
+    fprintf(out, "1: %zu [1: %zu] @", sample->size, sample->size);
+    for (int j = 0; j < sample->depth; j++) {
+      fprintf(out, " %p", sample->stack[j]);
+    }
+    fprintf(out, "\n");
+  }
+
+  alloc_mutex_unlock(&prof->lock);
+
+#if defined(__linux__)
+  FILE* maps = fopen("/proc/self/maps", "r");
+  if (maps) {
+    char line[512];
+    fprintf(out, "\nMAPPED_LIBRARIES:\n");
+    while (fgets(line, sizeof(line), maps)) {
+      fputs(line, out);
+    }
+    fclose(maps);
+  }
+#endif
+}
+
+static allocator profile_allocator_get(profile_allocator* prof) {
+  allocator alloc = {.alloc = profile_allocator_alloc,
+                     .realloc = profile_allocator_realloc,
+                     .free = profile_allocator_free,
+                     .ctx = prof};
+  return alloc;
+}
+
+#define TRACE_MAGIC 0x31435254434f4c41ULL
+#define TRACE_VERSION 1
+#define TRACE_RING_CAPACITY 4096
+#define TRACE_FLUSH_INTERVAL_MS 1
+
+#define TRACE_OP_ALLOC 1
+#define TRACE_OP_REALLOC 2
+#define TRACE_OP_FREE 3
+/* Stamped before a realloc that moved, for the address it gave up; the
+ * thread's next TRACE_OP_REALLOC names where the object went. */
+#define TRACE_OP_RELEASE 4
+
+typedef struct trace_file_header {
+  uint64_t magic;
+  uint32_t version;
+  uint32_t record_size;
+} trace_file_header;
+
+/* ptr is the address returned (alloc, realloc) or released (free); it serves
+ * as the object id, and replay maps it to its own pointers. */
+typedef struct trace_record {
+  uint64_t timestamp;
+  uint64_t ptr;
+  uint64_t old_ptr;
+  uint64_t size;
+  uint32_t thread;
+  uint8_t op;
+  uint8_t alignment_log2;
+  uint16_t reserved;
+} trace_record;
+
+typedef struct trace_ring trace_ring;
+
+/* Single producer (the owning thread), single consumer (whoever holds the
+ * trace lock while draining). */
+struct trace_ring {
+  trace_record* records;
+  size_t mask;
+  ALLOC_ATOMIC(size_t) head;
+  ALLOC_ATOMIC(size_t) tail;
+  ALLOC_ATOMIC(int) retired;
+  uint32_t thread;
+  trace_ring* next;
+};
+
+#if defined(_WIN32)
+typedef HANDLE trace_thread;
+#else
+typedef pthread_t trace_thread;
+#endif
+
+typedef struct trace_allocator {
+  allocator* backing;
+  FILE* file;
+  size_t ring_capacity;
+  alloc_mutex lock;
+  alloc_tls_key key;
+  trace_ring* rings;
+  trace_thread flusher;
+  ALLOC_ATOMIC(int) stop;
+  ALLOC_ATOMIC(uint32_t) next_thread;
+  ALLOC_ATOMIC(size_t) stalls;
+  ALLOC_ATOMIC(size_t) dropped;
+  size_t written;
+} trace_allocator;
+
+static void trace_ring_thread_exit(void* value) {
+  trace_ring* ring = (trace_ring*)value;
+  atomic_store_explicit(&ring->retired, 1, memory_order_release);
+}
+
+static trace_ring* trace_allocator_ring(trace_allocator* trace) {
+  trace_ring* ring = (trace_ring*)alloc_tls_get(trace->key);
+
+  if (ring) {
+    return ring;
+  }
+
+  /* Rings come from the C heap so tracing never perturbs the allocator
+   * being traced. */
+  ring = (trace_ring*)calloc(1, sizeof(trace_ring));
+  trace_record* records =
+      (trace_record*)malloc(trace->ring_capacity * sizeof(trace_record));
+
+  if (!ring || !records) {
+    free(ring);
+    free(records);
+    return NULL;
+  }
+
+  ring->records = records;
+  ring->mask = trace->ring_capacity - 1;
+  atomic_init(&ring->head, (size_t)0);
+  atomic_init(&ring->tail, (size_t)0);
+  atomic_init(&ring->retired, 0);
+  ring->thread = atomic_fetch_add_explicit(&trace->next_thread, 1,
+                                           memory_order_relaxed);
+
+  alloc_mutex_lock(&trace->lock);
+  ring->next = trace->rings;
+  trace->rings = ring;
+  alloc_mutex_unlock(&trace->lock);
+
+  alloc_tls_set(trace->key, ring);
+  return ring;
+}
+
+static void trace_allocator_emit(trace_allocator* trace, uint8_t op,
+                                 uint64_t timestamp, void* ptr,
+                                 void* old_ptr, size_t size,
+                                 size_t alignment) {
+  trace_ring* ring = trace_allocator_ring(trace);
+
+  if (!ring) {
+    atomic_fetch_add_explicit(&trace->dropped, 1, memory_order_relaxed);
+    return;
+  }
+
+  size_t head = atomic_load_explicit(&ring->head, memory_order_relaxed);
+
+  /* A full ring waits for the flusher rather than dropping records, since
+   * a trace with holes cannot be replayed. */
+  while (head - atomic_load_explicit(&ring->tail, memory_order_acquire) >
+         ring->mask) {
+    atomic_fetch_add_explicit(&trace->stalls, 1, memory_order_relaxed);
+#if defined(_WIN32)
+    SwitchToThread();
+#else
+    sched_yield();
+#endif
+  }
+
+  trace_record* record = &ring->records[head & ring->mask];
+  record->timestamp = timestamp;
+  record->ptr = (uint64_t)(uintptr_t)ptr;
+  record->old_ptr = (uint64_t)(uintptr_t)old_ptr;
+  record->size = size;
+  record->thread = ring->thread;
+  record->op = op;
+  record->alignment_log2 =
+      (uint8_t)(alignment ? alloc_bit_scan_reverse(alignment) : 0);
+  record->reserved = 0;
+
+  atomic_store_explicit(&ring->head, head + 1, memory_order_release);
+}
+
+/* Caller holds trace->lock. */
+static void trace_allocator_drain(trace_allocator* trace) {
+  trace_ring** link = &trace->rings;
+
+  while (*link) {
+    trace_ring* ring = *link;
+    int retired = atomic_load_explicit(&ring->retired, memory_order_acquire);
+    size_t tail = atomic_load_explicit(&ring->tail, memory_order_relaxed);
+    size_t head = atomic_load_explicit(&ring->head, memory_order_acquire);
+
+    while (tail != head) {
+      size_t start = tail & ring->mask;
+      size_t count = head - tail;
+      if (count > ring->mask + 1 - start) {
+        count = ring->mask + 1 - start;
+      }
+
+      fwrite(ring->records + start, sizeof(trace_record), count, trace->file);
+      trace->written += count;
+      tail += count;
+      atomic_store_explicit(&ring->tail, tail, memory_order_release);
+    }
+
+    if (retired) {
+      *link = ring->next;
+      free(ring->records);
+      free(ring);
+    } else {
+      link = &ring->next;
+    }
+  }
+}
+
+#if defined(_WIN32)
+static DWORD WINAPI trace_flusher_main(LPVOID param) {
+#else
+static void* trace_flusher_main(void* param) {
+#endif
+  trace_allocator* trace = (trace_allocator*)param;
+
+  while (!atomic_load_explicit(&trace->stop, memory_order_acquire)) {
+    alloc_mutex_lock(&trace->lock);
+    trace_allocator_drain(trace);
+    alloc_mutex_unlock(&trace->lock);
+
+#if defined(_WIN32)
+    Sleep(TRACE_FLUSH_INTERVAL_MS);
+#else
+    struct timespec interval = {0, TRACE_FLUSH_INTERVAL_MS * 1000000L};
+    nanosleep(&interval, NULL);
+#endif
+  }
+
+  return 0;
+}
+
+static void* trace_allocator_alloc(allocator* self, size_t size,
+                                   size_t alignment) {
+  trace_allocator* trace = (trace_allocator*)self->ctx;
+  void* ptr = alloc_alloc(trace->backing, size, alignment);
+
+  if (ptr) {
+    trace_allocator_emit(trace, TRACE_OP_ALLOC, alloc_cycle_count(), ptr,
+                         NULL, size, alignment);
+  }
+
+  return ptr;
+}
+
+static void* trace_allocator_realloc(allocator* self, void* ptr,
+                                     size_t old_size, size_t new_size,
+                                     size_t alignment) {
+  trace_allocator* trace = (trace_allocator*)self->ctx;
+
+  /* A moving realloc releases ptr inside the backing call, where another
+   * thread may pick it up, so that half is stamped before the call. */
+  uint64_t released = alloc_cycle_count();
+  void* new_ptr =
+      alloc_realloc(trace->backing, ptr, old_size, new_size, alignment);
+
+  if (new_ptr) {
+    if (ptr && new_ptr != ptr) {
+      trace_allocator_emit(trace, TRACE_OP_RELEASE, released, ptr, NULL,
+                           old_size, 0);
+    }
+    trace_allocator_emit(trace, ptr ? TRACE_OP_REALLOC : TRACE_OP_ALLOC,
+                         alloc_cycle_count(), new_ptr, ptr, new_size,
+                         alignment);
+  } else if (ptr && new_size == 0) {
+    /* Shrinking to nothing frees ptr, so record it as a free. */
+    trace_allocator_emit(trace, TRACE_OP_FREE, released, ptr, NULL,
+                         old_size, 0);
+  }
+
+  return new_ptr;
+}
+
+static void trace_allocator_free(allocator* self, void* ptr, size_t size) {
+  trace_allocator* trace = (trace_allocator*)self->ctx;
+
+  if (!ptr)
+    return;
+
+  /* Stamped before the free so a concurrent reuse of the address always
+   * sorts after it. */
+  trace_allocator_emit(trace, TRACE_OP_FREE, alloc_cycle_count(), ptr, NULL,
+                       size, 0);
+  alloc_free(trace->backing, ptr, size);
+}
+
+static int trace_allocator_init(trace_allocator* trace, allocator* backing,
+                                const char* path, size_t ring_capacity) {
+  size_t capacity = 1;
+  while (capacity < (ring_capacity ? ring_capacity : TRACE_RING_CAPACITY)) {
+    capacity <<= 1;
+  }
+
+  trace->backing = backing;
+  trace->ring_capacity = capacity;
+  trace->rings = NULL;
+  trace->written = 0;
+  trace->file = fopen(path, "wb");
+
+  if (!trace->file) {
+    return 0;
+  }
+
+  trace_file_header header = {.magic = TRACE_MAGIC,
+                              .version = TRACE_VERSION,
+                              .record_size = sizeof(trace_record)};
+  fwrite(&header, sizeof(header), 1, trace->file);
+
+  atomic_init(&trace->stop, 0);
+  atomic_init(&trace->next_thread, (uint32_t)0);
+  atomic_init(&trace->stalls, (size_t)0);
+  atomic_init(&trace->dropped, (size_t)0);
+  alloc_mutex_init(&trace->lock);
+
+  if (!alloc_tls_create(&trace->key, trace_ring_thread_exit)) {
+    alloc_mutex_destroy(&trace->lock);
+    fclose(trace->file);
+    return 0;
+  }
+
+#if defined(_WIN32)
+  trace->flusher = CreateThread(NULL, 0, trace_flusher_main, trace, 0, NULL);
+  int started = trace->flusher != NULL;
+#else
+  int started =
+      pthread_create(&trace->flusher, NULL, trace_flusher_main, trace) == 0;
+#endif
+
+  if (!started) {
+    alloc_tls_delete(trace->key);
+    alloc_mutex_destroy(&trace->lock);
+    fclose(trace->file);
+    return 0;
+  }
+
+  return 1;
+}
+
+static void trace_allocator_flush(trace_allocator* trace) {
+  alloc_mutex_lock(&trace->lock);
+  trace_allocator_drain(trace);
+  fflush(trace->file);
+  alloc_mutex_unlock(&trace->lock);
+}
+
+/* Stops the flusher and writes out whatever is still buffered. Threads
+ * that keep using the allocator afterwards are not supported. */
+static void trace_allocator_destroy(trace_allocator* trace) {
+  atomic_store_explicit(&trace->stop, 1, memory_order_release);
+
+#if defined(_WIN32)
+  WaitForSingleObject(trace->flusher, INFINITE);
+  CloseHandle(trace->flusher);
+#else
+  pthread_join(trace->flusher, NULL);
+#endif
+
+  trace_allocator_drain(trace);
+
+  while (trace->rings) {
+    trace_ring* ring = trace->rings;
+    trace->rings = ring->next;
+    free(ring->records);
+    free(ring);
+  }
+
+  alloc_tls_delete(trace->key);
+  alloc_mutex_destroy(&trace->lock);
+  fclose(trace->file);
+  trace->file = NULL;
+}
+
+static allocator trace_allocator_get(trace_allocator* trace) {
+  allocator alloc = {.alloc = trace_allocator_alloc,
+                     .realloc = trace_allocator_realloc,
+                     .free = trace_allocator_free,
+                     .ctx = trace};
+  return alloc;
+}
+
+#if defined(ALLOC_DEBUG)
+
+#ifndef DEBUG_ALLOCATOR_REDZONE
+#define DEBUG_ALLOCATOR_REDZONE 16
+#endif
+
+#ifndef DEBUG_ALLOCATOR_QUARANTINE
+#define DEBUG_ALLOCATOR_QUARANTINE 64
+#endif
+
+#define DEBUG_ALLOCATOR_MAGIC 0xa110cdebu
+#define DEBUG_ALLOCATOR_FREED 0xdeadf7eeu
+#define DEBUG_CANARY_BYTE 0xfd
+#define DEBUG_ALLOC_BYTE 0xcd
+#define DEBUG_FREED_BYTE 0xdd
+
+typedef struct debug_header debug_header;
+
+struct debug_header {
+  debug_header* prev;
+  debug_header* next;
+  size_t size;
+  size_t alignment;
+  size_t front;
+  uint32_t magic;
+  uint32_t pad;
+};
+
+typedef struct debug_allocator {
+  allocator* backing;
+  alloc_mutex lock;
+  debug_header* live;
+  size_t live_count;
+  size_t live_bytes;
+  size_t errors;
+  void (*on_error)(const char* message, void* ptr);
+  debug_header* quarantine[DEBUG_ALLOCATOR_QUARANTINE];
+  size_t quarantine_next;
+} debug_allocator;
+
+static inline size_t debug_allocator_front(size_t alignment) {
+  return align_forward(sizeof(debug_header) + DEBUG_ALLOCATOR_REDZONE,
+                       alignment);
+}
+
+static inline debug_header* debug_allocator_header(void* ptr) {
+  return (debug_header*)((uint8_t*)ptr - DEBUG_ALLOCATOR_REDZONE) - 1;
+}
+
+static inline size_t debug_allocator_total(debug_header* header) {
+  return header->front + header->size + DEBUG_ALLOCATOR_REDZONE;
+}
+
+static void debug_allocator_error(debug_allocator* dbg, const char* message,
+                                  void* ptr) {
+  dbg->errors++;
+
+  if (dbg->on_error) {
+    dbg->on_error(message, ptr);
+    return;
+  }
+
+  fprintf(stderr, "debug_allocator: %s at %p\n", message, ptr);
+  abort();
+}
+
+static int debug_allocator_check_bytes(const uint8_t* bytes, size_t size,
+                                       uint8_t value) {
+  for (size_t i = 0; i < size; i++) {
+    if (bytes[i] != value) {
+      return 0;
+    }
+  }
+
+  return 1;
 }
 
-static void pool_allocator_init(pool_allocator* pool, void* buffer,
-                                size_t chunk_size, size_t chunk_count) {
-  pool->buffer = (uint8_t*)buffer;
-  pool->chunk_size = chunk_size;
-  pool->chunk_count = chunk_count;
-  pool->backing = NULL;
-  pool->free_list = NULL;
+static int debug_allocator_check(debug_allocator* dbg, debug_header* header,
+                                 size_t size) {
+  uint8_t* user = (uint8_t*)(header + 1) + DEBUG_ALLOCATOR_REDZONE;
+
+  if (header->magic == DEBUG_ALLOCATOR_FREED) {
+    debug_allocator_error(dbg, "double free", user);
+    return 0;
+  }
+
+  if (header->magic != DEBUG_ALLOCATOR_MAGIC) {
+    debug_allocator_error(dbg, "free of unknown pointer", user);
+    return 0;
+  }
+
+  int ok = 1;
+
+  if (!debug_allocator_check_bytes(user - DEBUG_ALLOCATOR_REDZONE,
+                                   DEBUG_ALLOCATOR_REDZONE,
+                                   DEBUG_CANARY_BYTE)) {
+    debug_allocator_error(dbg, "buffer underflow", user);
+    ok = 0;
+  }
+
+  if (!debug_allocator_check_bytes(user + header->size,
+                                   DEBUG_ALLOCATOR_REDZONE,
+                                   DEBUG_CANARY_BYTE)) {
+    debug_allocator_error(dbg, "buffer overflow", user);
+    ok = 0;
+  }
 
-  for (size_t i = 0; i < chunk_count; i++) {
-    void* chunk = pool->buffer + (chunk_count - 1 - i) * chunk_size;
-    void** free_node = (void**)chunk;
-    *free_node = pool->free_list;
-    pool->free_list = free_node;
+  if (size != SIZE_MAX && size != header->size) {
+    debug_allocator_error(dbg, "free size mismatch", user);
+    ok = 0;
   }
-}
 
-static allocator pool_allocator_get(pool_allocator* pool) {
-  allocator alloc = {.alloc = pool_allocator_alloc,
-                     .realloc = pool_allocator_realloc,
-                     .free = pool_allocator_free,
-                     .ctx = pool};
-  return alloc;
+  return ok;
 }
 
-typedef struct stack_allocator {
-  uint8_t* buffer;
-  size_t buffer_size;
-  size_t offset;
-  allocator* backing;
-} stack_allocator;
+static void debug_allocator_retire(debug_allocator* dbg,
+                                   debug_header* header) {
+  uint8_t* user = (uint8_t*)(header + 1) + DEBUG_ALLOCATOR_REDZONE;
+  size_t slot = dbg->quarantine_next;
+  debug_header* evicted = dbg->quarantine[slot];
 
-typedef struct stack_marker {
-  size_t offset;
-} stack_marker;
+  header->magic = DEBUG_ALLOCATOR_FREED;
+  memset(user, DEBUG_FREED_BYTE, header->size);
+  dbg->quarantine[slot] = header;
+  dbg->quarantine_next = (slot + 1) % DEBUG_ALLOCATOR_QUARANTINE;
 
-static void* stack_allocator_alloc(allocator* self, size_t size,
+  if (evicted) {
+    uint8_t* old = (uint8_t*)(evicted + 1) + DEBUG_ALLOCATOR_REDZONE;
+
+    if (!debug_allocator_check_bytes(old, evicted->size, DEBUG_FREED_BYTE)) {
+      debug_allocator_error(dbg, "write after free", old);
+    }
+
+    alloc_free(dbg->backing, old - evicted->front,
+               debug_allocator_total(evicted));
+  }
+}
+
+static void* debug_allocator_alloc(allocator* self, size_t size,
                                    size_t alignment) {
-  stack_allocator* stack = (stack_allocator*)self->ctx;
+  debug_allocator* dbg = (debug_allocator*)self->ctx;
 
-  size_t aligned_offset = align_forward(stack->offset, alignment);
+  if (alignment < sizeof(void*)) {
+    alignment = sizeof(void*);
+  }
 
-  if (aligned_offset + size > stack->buffer_size) {
+  size_t front = debug_allocator_front(alignment);
+  uint8_t* raw = (uint8_t*)alloc_alloc(
+      dbg->backing, front + size + DEBUG_ALLOCATOR_REDZONE, alignment);
+
+  if (!raw) {
     return NULL;
   }
 
-  void* ptr = stack->buffer + aligned_offset;
-  stack->offset = aligned_offset + size;
+  uint8_t* user = raw + front;
+  debug_header* header = debug_allocator_header(user);
+  header->size = size;
+  header->alignment = alignment;
+  header->front = front;
+  header->magic = DEBUG_ALLOCATOR_MAGIC;
+
+  memset(user - DEBUG_ALLOCATOR_REDZONE, DEBUG_CANARY_BYTE,
+         DEBUG_ALLOCATOR_REDZONE);
+  memset(user, DEBUG_ALLOC_BYTE, size);
+  memset(user + size, DEBUG_CANARY_BYTE, DEBUG_ALLOCATOR_REDZONE);
+
+  alloc_mutex_lock(&dbg->lock);
+  header->prev = NULL;
+  header->next = dbg->live;
+  if (dbg->live) {
+    dbg->live->prev = header;
+  }
+  dbg->live = header;
+  dbg->live_count++;
+  dbg->live_bytes += size;
+  alloc_mutex_unlock(&dbg->lock);
 
-  return ptr;
+  return user;
 }
 
-static void* stack_allocator_realloc(allocator* self, void* ptr,
-                                     size_t old_size, size_t new_size,
-                                     size_t alignment) {
-  stack_allocator* stack = (stack_allocator*)self->ctx;
+static void debug_allocator_free(allocator* self, void* ptr, size_t size) {
+  debug_allocator* dbg = (debug_allocator*)self->ctx;
 
-  if (!ptr) {
-    return stack_allocator_alloc(self, new_size, alignment);
+  if (!ptr)
+    return;
+
+  debug_header* header = debug_allocator_header(ptr);
+
+  alloc_mutex_lock(&dbg->lock);
+
+  if (header->magic != DEBUG_ALLOCATOR_MAGIC) {
+    debug_allocator_check(dbg, header, size);
+    alloc_mutex_unlock(&dbg->lock);
+    return;
   }
 
-  uint8_t* byte_ptr = (uint8_t*)ptr;
+  debug_allocator_check(dbg, header, size);
 
-  if (byte_ptr + old_size == stack->buffer + stack->offset) {
-    size_t aligned_offset =
-        align_forward((size_t)(byte_ptr - stack->buffer), alignment);
+  if (header->prev) {
+    header->prev->next = header->next;
+  } else {
+    dbg->live = header->next;
+  }
+  if (header->next) {
+    header->next->prev = header->prev;
+  }
+  dbg->live_count--;
+  dbg->live_bytes -= header->size;
 
-    if (aligned_offset + new_size <= stack->buffer_size) {
-      stack->offset = aligned_offset + new_size;
-      return ptr;
-    }
+  debug_allocator_retire(dbg, header);
+  alloc_mutex_unlock(&dbg->lock);
+}
+
+static void* debug_allocator_realloc(allocator* self, void* ptr,
+                                     size_t old_size, size_t new_size,
+                                     size_t alignment) {
+  if (!ptr) {
+    return debug_allocator_alloc(self, new_size, alignment);
   }
 
-  void* new_ptr = stack_allocator_alloc(self, new_size, alignment);
+  void* new_ptr = debug_allocator_alloc(self, new_size, alignment);
 
-  if (new_ptr && ptr) {
+  if (new_ptr) {
     memcpy(new_ptr, ptr, old_size < new_size ? old_size : new_size);
+    debug_allocator_free(self, ptr, old_size);
   }
 
   return new_ptr;
 }
 
-static void stack_allocator_free(allocator* self, void* ptr, size_t size) {
-  stack_allocator* stack = (stack_allocator*)self->ctx;
-
-  if (!ptr)
-    return;
+static void debug_allocator_init(debug_allocator* dbg, allocator* backing) {
+  memset(dbg, 0, sizeof(*dbg));
+  dbg->backing = backing;
+  alloc_mutex_init(&dbg->lock);
+}
 
-  uint8_t* byte_ptr = (uint8_t*)ptr;
+static size_t debug_allocator_verify(debug_allocator* dbg) {
+  size_t before = dbg->errors;
 
-  if (byte_ptr + size == stack->buffer + stack->offset) {
-    stack->offset = (size_t)(byte_ptr - stack->buffer);
+  alloc_mutex_lock(&dbg->lock);
+  for (debug_header* header = dbg->live; header; header = header->next) {
+    debug_allocator_check(dbg, header, SIZE_MAX);
   }
-}
+  alloc_mutex_unlock(&dbg->lock);
 
-static void stack_allocator_init(stack_allocator* stack, void* buffer,
-                                 size_t size) {
-  stack->buffer = (uint8_t*)buffer;
-  stack->buffer_size = size;
-  stack->offset = 0;
-  stack->backing = NULL;
+  return dbg->errors - before;
 }
 
-static stack_marker stack_allocator_mark(stack_allocator* stack) {
-  stack_marker marker = {.offset = stack->offset};
-  return marker;
-}
+static size_t debug_allocator_report_leaks(debug_allocator* dbg, FILE* out) {
+  alloc_mutex_lock(&dbg->lock);
+  for (debug_header* header = dbg->live; header; header = header->next) {
+    fprintf(out, "debug_allocator: leaked %zu bytes at %p\n", header->size,
+            (void*)((uint8_t*)(header + 1) + DEBUG_ALLOCATOR_REDZONE));
+  }
+  size_t count = dbg->live_count;
+  alloc_mutex_unlock(&dbg->lock);
 
-static void stack_allocator_restore(stack_allocator* stack,
-                                    stack_marker marker) {
-  stack->offset = marker.offset;
+  return count;
 }
 
-static void stack_allocator_reset(stack_allocator* stack) {
-  stack->offset = 0;
+static void debug_allocator_destroy(debug_allocator* dbg) {
+  for (size_t i = 0; i < DEBUG_ALLOCATOR_QUARANTINE; i++) {
+    debug_header* header = dbg->quarantine[i];
+    if (header) {
+      alloc_free(dbg->backing,
+                 (uint8_t*)(header + 1) + DEBUG_ALLOCATOR_REDZONE -
+                     header->front,
+                 debug_allocator_total(header));
+      dbg->quarantine[i] = NULL;
+    }
+  }
+
+  alloc_mutex_destroy(&dbg->lock);
 }
 
-static allocator stack_allocator_get(stack_allocator* stack) {
-  allocator alloc = {.alloc = stack_allocator_alloc,
-                     .realloc = stack_allocator_realloc,
-                     .free = stack_allocator_free,
-                     .ctx = stack};
+static allocator debug_allocator_get(debug_allocator* dbg) {
+  allocator alloc = {.alloc = debug_allocator_alloc,
+                     .realloc = debug_allocator_realloc,
+                     .free = debug_allocator_free,
+                     .ctx = dbg};
   return alloc;
 }
 
-typedef struct scratch_allocator {
+#else
+
+typedef struct debug_allocator {
   allocator* backing;
-  void** allocations;
-  size_t allocation_count;
-  size_t allocation_capacity;
-} scratch_allocator;
+} debug_allocator;
 
-static void* scratch_allocator_alloc(allocator* self, size_t size,
-                                     size_t alignment) {
-  scratch_allocator* scratch = (scratch_allocator*)self->ctx;
+static inline void debug_allocator_init(debug_allocator* dbg,
+                                        allocator* backing) {
+  dbg->backing = backing;
+}
 
-  void* ptr = alloc_alloc(scratch->backing, size, alignment);
+static inline size_t debug_allocator_verify(debug_allocator* dbg) {
+  (void)dbg;
+  return 0;
+}
 
-  if (!ptr)
-    return NULL;
+static inline size_t debug_allocator_report_leaks(debug_allocator* dbg,
+                                                  FILE* out) {
+  (void)dbg;
+  (void)out;
+  return 0;
+}
 
-  if (scratch->allocation_count >= scratch->allocation_capacity) {
-    size_t new_capacity = scratch->allocation_capacity == 0
-                              ? 8
-                              : scratch->allocation_capacity * 2;
-    void** new_allocations =
-        (void**)alloc_realloc(scratch->backing, scratch->allocations,
-                              scratch->allocation_capacity * sizeof(void*),
-                              new_capacity * sizeof(void*), sizeof(void*));
-
-    if (!new_allocations) {
-      alloc_free(scratch->backing, ptr, size);
-      return NULL;
-    }
+static inline void debug_allocator_destroy(debug_allocator* dbg) {
+  (void)dbg;
+}
+
+static inline allocator debug_allocator_get(debug_allocator* dbg) {
+  return *dbg->backing;
+}
+
+#endif
 
-    scratch->allocations = new_allocations;
-    scratch->allocation_capacity = new_capacity;
+#define ALLOC_DEFINE_DIRECT(type, prefix)                                     \
+  static inline void* prefix##_alloc_direct(type* a, size_t size,             \
+                                            size_t alignment) {               \
+    allocator self = {.ctx = a};                                              \
+    return prefix##_alloc(&self, size, alignment);                            \
+  }                                                                           \
+                                                                              \
+  static inline void* prefix##_realloc_direct(type* a, void* ptr,             \
+                                              size_t old_size,                \
+                                              size_t new_size,                \
+                                              size_t alignment) {             \
+    allocator self = {.ctx = a};                                              \
+    return prefix##_realloc(&self, ptr, old_size, new_size, alignment);       \
+  }                                                                           \
+                                                                              \
+  static inline void prefix##_free_direct(type* a, void* ptr, size_t size) {  \
+    allocator self = {.ctx = a};                                              \
+    prefix##_free(&self, ptr, size);                                          \
   }
 
-  scratch->allocations[scratch->allocation_count++] = ptr;
+ALLOC_DEFINE_DIRECT(arena_allocator, arena_allocator)
+ALLOC_DEFINE_DIRECT(virtual_arena_allocator, virtual_arena_allocator)
+ALLOC_DEFINE_DIRECT(pool_allocator, pool_allocator)
+ALLOC_DEFINE_DIRECT(stack_allocator, stack_allocator)
+ALLOC_DEFINE_DIRECT(scratch_allocator, scratch_allocator)
+ALLOC_DEFINE_DIRECT(freelist_allocator, freelist_allocator)
+ALLOC_DEFINE_DIRECT(buddy_allocator, buddy_allocator)
+ALLOC_DEFINE_DIRECT(tcache_allocator, tcache_allocator)
+ALLOC_DEFINE_DIRECT(concurrent_pool_allocator, concurrent_pool_allocator)
+ALLOC_DEFINE_DIRECT(slab_allocator, slab_allocator)
+
+#if !defined(__cplusplus) && defined(__STDC_VERSION__) && \
+    __STDC_VERSION__ >= 201112L
+#define ALLOC_DIRECT_SELECT(a, op)                                       \
+  _Generic((a),                                                          \
+      arena_allocator *: arena_allocator_##op##_direct,                  \
+      virtual_arena_allocator *: virtual_arena_allocator_##op##_direct,  \
+      pool_allocator *: pool_allocator_##op##_direct,                    \
+      stack_allocator *: stack_allocator_##op##_direct,                  \
+      scratch_allocator *: scratch_allocator_##op##_direct,              \
+      freelist_allocator *: freelist_allocator_##op##_direct,            \
+      buddy_allocator *: buddy_allocator_##op##_direct,                  \
+      tcache_allocator *: tcache_allocator_##op##_direct,                \
+      concurrent_pool_allocator *: concurrent_pool_allocator_##op##_direct, \
+      slab_allocator *: slab_allocator_##op##_direct)
+
+#define alloc_direct_alloc(a, size, alignment) \
+  ALLOC_DIRECT_SELECT(a, alloc)(a, size, alignment)
+#define alloc_direct_realloc(a, ptr, old_size, new_size, alignment) \
+  ALLOC_DIRECT_SELECT(a, realloc)(a, ptr, old_size, new_size, alignment)
+#define alloc_direct_free(a, ptr, size) \
+  ALLOC_DIRECT_SELECT(a, free)(a, ptr, size)
+#endif
 
-  return ptr;
-}
+#if defined(__cplusplus)
+namespace alloc {
 
-static void* scratch_allocator_realloc(allocator* self, void* ptr,
-                                       size_t old_size, size_t new_size,
-                                       size_t alignment) {
-  scratch_allocator* scratch = (scratch_allocator*)self->ctx;
+template <size_t Size, size_t Alignment = alignof(max_align_t)>
+class arena {
+ public:
+  static constexpr size_t capacity = Size;
 
-  if (!ptr) {
-    return scratch_allocator_alloc(self, new_size, alignment);
+  arena() { arena_allocator_init(&arena_, buffer_, Size); }
+  /* The buffer returns to the enclosing stack or object, so drop the
+   * poison the allocator left on it. */
+  ~arena() { ALLOC_ASAN_UNPOISON(buffer_, Size); }
+  arena(const arena&) = delete;
+  arena& operator=(const arena&) = delete;
+
+  void* allocate(size_t size, size_t alignment = alignof(max_align_t)) {
+    return arena_allocator_alloc_direct(&arena_, size, alignment);
   }
 
-  void* new_ptr =
-      alloc_realloc(scratch->backing, ptr, old_size, new_size, alignment);
+  void* reallocate(void* ptr, size_t old_size, size_t new_size,
+                   size_t alignment = alignof(max_align_t)) {
+    return arena_allocator_realloc_direct(&arena_, ptr, old_size, new_size,
+                                          alignment);
+  }
 
-  if (!new_ptr)
-    return NULL;
+  void deallocate(void* ptr, size_t size) {
+    arena_allocator_free_direct(&arena_, ptr, size);
+  }
 
-  for (size_t i = 0; i < scratch->allocation_count; i++) {
-    if (scratch->allocations[i] == ptr) {
-      scratch->allocations[i] = new_ptr;
-      break;
-    }
+  arena_marker mark() { return arena_allocator_mark(&arena_); }
+  void restore(arena_marker marker) {
+    arena_allocator_restore(&arena_, marker);
   }
+  void reset() { arena_allocator_reset(&arena_); }
+  size_t used() const { return arena_.offset; }
 
-  return new_ptr;
-}
+  allocator get() { return arena_allocator_get(&arena_); }
+  arena_allocator* native() { return &arena_; }
 
-static void scratch_allocator_free(allocator* self, void* ptr, size_t size) {
-  (void)self;
-  (void)ptr;
-  (void)size;
-}
+ private:
+  alignas(Alignment) uint8_t buffer_[Size];
+  arena_allocator arena_;
+};
 
-static void scratch_allocator_init(scratch_allocator* scratch,
-                                   allocator* backing) {
-  scratch->backing = backing;
-  scratch->allocations = NULL;
-  scratch->allocation_count = 0;
-  scratch->allocation_capacity = 0;
-}
+template <size_t ChunkSize, size_t ChunkCount,
+          size_t Alignment = alignof(max_align_t)>
+class pool {
+ public:
+  static constexpr size_t chunk_size = ChunkSize;
+  static constexpr size_t chunk_count = ChunkCount;
+  static constexpr size_t chunk_stride =
+      ((ChunkSize < sizeof(void*) ? sizeof(void*) : ChunkSize) + Alignment -
+       1) &
+      ~(Alignment - 1);
+
+  pool() {
+    pool_allocator_init_aligned(&pool_, buffer_, ChunkSize, ChunkCount,
+                                Alignment);
+  }
+  ~pool() { ALLOC_ASAN_UNPOISON(buffer_, sizeof(buffer_)); }
+  pool(const pool&) = delete;
+  pool& operator=(const pool&) = delete;
 
-static void scratch_allocator_reset(scratch_allocator* scratch) {
-  for (size_t i = 0; i < scratch->allocation_count; i++) {
-    alloc_free(scratch->backing, scratch->allocations[i], 0);
+  void* allocate(size_t size = ChunkSize, size_t alignment = Alignment) {
+    return pool_allocator_alloc_direct(&pool_, size, alignment);
   }
 
-  scratch->allocation_count = 0;
-}
+  void deallocate(void* ptr, size_t size = ChunkSize) {
+    pool_allocator_free_direct(&pool_, ptr, size);
+  }
 
-static void scratch_allocator_destroy(scratch_allocator* scratch) {
-  scratch_allocator_reset(scratch);
+  size_t live() const { return pool_.live_count; }
 
-  if (scratch->allocations) {
-    alloc_free(scratch->backing, scratch->allocations,
-               scratch->allocation_capacity * sizeof(void*));
+  allocator get() { return pool_allocator_get(&pool_); }
+  pool_allocator* native() { return &pool_; }
+
+ private:
+  alignas(Alignment) uint8_t buffer_[chunk_stride * ChunkCount];
+  pool_allocator pool_;
+};
+
+template <size_t Size, size_t Alignment = alignof(max_align_t)>
+class stack {
+ public:
+  static constexpr size_t capacity = Size;
+
+  stack() { stack_allocator_init(&stack_, buffer_, Size); }
+  ~stack() { ALLOC_ASAN_UNPOISON(buffer_, Size); }
+  stack(const stack&) = delete;
+  stack& operator=(const stack&) = delete;
+
+  void* allocate(size_t size, size_t alignment = alignof(max_align_t)) {
+    return stack_allocator_alloc_direct(&stack_, size, alignment);
   }
 
-  scratch->allocations = NULL;
-  scratch->allocation_capacity = 0;
-}
+  void deallocate(void* ptr, size_t size) {
+    stack_allocator_free_direct(&stack_, ptr, size);
+  }
 
-static allocator scratch_allocator_get(scratch_allocator* scratch) {
-  allocator alloc = {.alloc = scratch_allocator_alloc,
-                     .realloc = scratch_allocator_realloc,
-                     .free = scratch_allocator_free,
-                     .ctx = scratch};
-  return alloc;
-}
+  stack_marker mark() { return stack_allocator_mark(&stack_); }
+  void restore(stack_marker marker) {
+    stack_allocator_restore(&stack_, marker);
+  }
+  void reset() { stack_allocator_reset(&stack_); }
 
-typedef struct freelist_node freelist_node;
+  allocator get() { return stack_allocator_get(&stack_); }
+  stack_allocator* native() { return &stack_; }
 
-struct freelist_node {
-  size_t size;
-  freelist_node* next;
+ private:
+  alignas(Alignment) uint8_t buffer_[Size];
+  stack_allocator stack_;
 };
 
-typedef struct freelist_allocator {
-  uint8_t* buffer;
-  size_t buffer_size;
-  freelist_node* free_list;
-  allocator* backing;
-} freelist_allocator;
+template <size_t Size, size_t Alignment = alignof(max_align_t)>
+class freelist {
+ public:
+  static constexpr size_t capacity = Size;
 
-static void freelist_allocator_free(allocator* self, void* ptr, size_t size);
+  freelist() { freelist_allocator_init(&freelist_, buffer_, Size); }
+  ~freelist() { ALLOC_ASAN_UNPOISON(buffer_, Size); }
+  freelist(const freelist&) = delete;
+  freelist& operator=(const freelist&) = delete;
 
-static void* freelist_allocator_alloc(allocator* self, size_t size,
-                                      size_t alignment) {
-  freelist_allocator* freelist = (freelist_allocator*)self->ctx;
+  void* allocate(size_t size, size_t alignment = alignof(max_align_t)) {
+    return freelist_allocator_alloc_direct(&freelist_, size, alignment);
+  }
 
-  size_t total_size = size + alignment - 1;
+  void* reallocate(void* ptr, size_t old_size, size_t new_size,
+                   size_t alignment = alignof(max_align_t)) {
+    return freelist_allocator_realloc_direct(&freelist_, ptr, old_size,
+                                             new_size, alignment);
+  }
 
-  freelist_node** prev_ptr = &freelist->free_list;
-  freelist_node* node = freelist->free_list;
+  void deallocate(void* ptr, size_t size) {
+    freelist_allocator_free_direct(&freelist_, ptr, size);
+  }
 
-  while (node) {
-    if (node->size >= total_size) {
-      uintptr_t addr = (uintptr_t)node;
-      uintptr_t aligned_addr = align_forward(addr, alignment);
-      size_t padding = aligned_addr - addr;
-
-      if (node->size >= size + padding) {
-        *prev_ptr = node->next;
-
-        if (node->size > total_size + sizeof(freelist_node)) {
-          freelist_node* new_node =
-              (freelist_node*)((uint8_t*)node + size + padding);
-          new_node->size = node->size - (size + padding);
-          new_node->next = freelist->free_list;
-          freelist->free_list = new_node;
-        }
+  allocator get() { return freelist_allocator_get(&freelist_); }
+  freelist_allocator* native() { return &freelist_; }
 
-        return (void*)aligned_addr;
-      }
+ private:
+  alignas(Alignment) uint8_t buffer_[Size];
+  freelist_allocator freelist_;
+};
+
+[[noreturn]] inline void throw_bad_alloc() {
+#if defined(__cpp_exceptions)
+  throw std::bad_alloc();
+#else
+  abort();
+#endif
+}
+
+/* Source returns the shared allocator, so instances are empty and equal. */
+template <typename T, allocator* (*Source)() = c_allocator>
+class stl_allocator {
+ public:
+  using value_type = T;
+  using is_always_equal = std::true_type;
+  using propagate_on_container_move_assignment = std::true_type;
+
+  template <typename U>
+  struct rebind {
+    using other = stl_allocator<U, Source>;
+  };
+
+  stl_allocator() noexcept = default;
+  template <typename U>
+  stl_allocator(const stl_allocator<U, Source>&) noexcept {}
+
+  T* allocate(size_t count) {
+    if (count > SIZE_MAX / sizeof(T)) {
+      throw_bad_alloc();
     }
 
-    prev_ptr = &node->next;
-    node = node->next;
-  }
+    void* ptr = alloc_alloc(Source(), count * sizeof(T), alignof(T));
+    if (!ptr) {
+      throw_bad_alloc();
+    }
 
-  return NULL;
-}
+    return static_cast<T*>(ptr);
+  }
 
-static void* freelist_allocator_realloc(allocator* self, void* ptr,
-                                        size_t old_size, size_t new_size,
-                                        size_t alignment) {
-  if (!ptr) {
-    return freelist_allocator_alloc(self, new_size, alignment);
+  void deallocate(T* ptr, size_t count) noexcept {
+    alloc_free(Source(), ptr, count * sizeof(T));
   }
 
-  void* new_ptr = freelist_allocator_alloc(self, new_size, alignment);
+  template <typename U>
+  bool operator==(const stl_allocator<U, Source>&) const noexcept {
+    return true;
+  }
 
-  if (new_ptr && ptr) {
-    memcpy(new_ptr, ptr, old_size < new_size ? old_size : new_size);
-    freelist_allocator_free(self, ptr, old_size);
+  template <typename U>
+  bool operator!=(const stl_allocator<U, Source>&) const noexcept {
+    return false;
   }
+};
 
-  return new_ptr;
-}
+#if defined(ALLOC_HAS_PMR)
+/* Equal to another resource wrapping the same allocator. */
+class memory_resource : public std::pmr::memory_resource {
+ public:
+  explicit memory_resource(allocator* a) noexcept : allocator_(a) {}
 
-static void freelist_allocator_free(allocator* self, void* ptr, size_t size) {
-  freelist_allocator* freelist = (freelist_allocator*)self->ctx;
+  allocator* get() const noexcept { return allocator_; }
 
-  if (!ptr)
-    return;
+ private:
+  void* do_allocate(size_t size, size_t alignment) override {
+    void* ptr = alloc_alloc(allocator_, size, alignment);
+    if (!ptr) {
+      throw_bad_alloc();
+    }
+    return ptr;
+  }
 
-  freelist_node* node = (freelist_node*)ptr;
-  node->size = size;
-  node->next = freelist->free_list;
-  freelist->free_list = node;
-}
+  void do_deallocate(void* ptr, size_t size, size_t alignment) override {
+    (void)alignment;
+    alloc_free(allocator_, ptr, size);
+  }
 
-static void freelist_allocator_init(freelist_allocator* freelist, void* buffer,
-                                    size_t size) {
-  freelist->buffer = (uint8_t*)buffer;
-  freelist->buffer_size = size;
-  freelist->backing = NULL;
+  bool do_is_equal(
+      const std::pmr::memory_resource& other) const noexcept override {
+    if (this == &other) {
+      return true;
+    }
+#if defined(__cpp_rtti) || defined(__GXX_RTTI) || defined(_CPPRTTI)
+    const memory_resource* wrapped =
+        dynamic_cast<const memory_resource*>(&other);
+    return wrapped && wrapped->allocator_ == allocator_;
+#else
+    return false;
+#endif
+  }
 
-  freelist->free_list = (freelist_node*)buffer;
-  freelist->free_list->size = size;
-  freelist->free_list->next = NULL;
-}
+  allocator* allocator_;
+};
+#endif
 
-static allocator freelist_allocator_get(freelist_allocator* freelist) {
-  allocator alloc = {.alloc = freelist_allocator_alloc,
-                     .realloc = freelist_allocator_realloc,
-                     .free = freelist_allocator_free,
-                     .ctx = freelist};
-  return alloc;
-}
+}  // namespace alloc
+#endif
+
+#if defined(__cplusplus) && defined(__GNUC__)
+#pragma GCC diagnostic pop
+#endif
 
 #endif
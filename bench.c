@@ -0,0 +1,884 @@
+#include "alloc.h"
+
+#include <time.h>
+
+#if !defined(_WIN32)
+#include <sched.h>
+#endif
+
+#if defined(BENCH_MIMALLOC)
+#include <mimalloc.h>
+#endif
+
+#if defined(BENCH_JEMALLOC)
+#include <jemalloc/jemalloc.h>
+#endif
+
+#define BENCH_SEED 0x9e3779b97f4a7c15ull
+#define BENCH_REPEATS 5
+#define BENCH_BATCH 64
+#define BENCH_MAX_THREADS 64
+
+#define BENCH_FREE_ANY 1
+#define BENCH_FREE_LIFO 2
+#define BENCH_RESET 4
+#define BENCH_REALLOC 8
+#define BENCH_THREAD_SAFE 16
+#define BENCH_VARIABLE_SIZE 32
+#define BENCH_GENERAL \
+  (BENCH_FREE_ANY | BENCH_FREE_LIFO | BENCH_REALLOC | BENCH_VARIABLE_SIZE)
+
+typedef struct bench_subject bench_subject;
+
+struct bench_subject {
+  const char* name;
+  int flags;
+  int (*create)(bench_subject* subject, size_t threads);
+  void (*reset)(bench_subject* subject);
+  void (*destroy)(bench_subject* subject);
+  allocator alloc;
+  void* state;
+};
+
+typedef struct bench_result {
+  double seconds;
+  double ops;
+  double* samples;
+  size_t sample_count;
+  size_t sample_capacity;
+} bench_result;
+
+static uint64_t bench_time_ns(void) {
+#if defined(_WIN32)
+  LARGE_INTEGER counter, frequency;
+  QueryPerformanceCounter(&counter);
+  QueryPerformanceFrequency(&frequency);
+  return (uint64_t)((double)counter.QuadPart * 1e9 /
+                    (double)frequency.QuadPart);
+#else
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t)ts.tv_sec * 1000000000ull + (uint64_t)ts.tv_nsec;
+#endif
+}
+
+static void bench_yield(void) {
+#if defined(_WIN32)
+  SwitchToThread();
+#else
+  sched_yield();
+#endif
+}
+
+static uint64_t bench_random(uint64_t* state) {
+  uint64_t x = *state;
+  x ^= x >> 12;
+  x ^= x << 25;
+  x ^= x >> 27;
+  *state = x;
+  return x * 0x2545f4914f6cdd1dull;
+}
+
+static size_t bench_random_size(uint64_t* state, size_t min, size_t max) {
+  return min + (size_t)(bench_random(state) % (max - min + 1));
+}
+
+static void bench_sample(bench_result* result, uint64_t elapsed, size_t ops) {
+  if (result->sample_count == result->sample_capacity) {
+    size_t capacity =
+        result->sample_capacity ? result->sample_capacity * 2 : 1024;
+    double* samples =
+        (double*)realloc(result->samples, capacity * sizeof(double));
+    if (!samples) {
+      return;
+    }
+    result->samples = samples;
+    result->sample_capacity = capacity;
+  }
+
+  result->samples[result->sample_count++] = (double)elapsed / (double)ops;
+}
+
+static void bench_merge(bench_result* result, bench_result* other) {
+  if (!result->samples) {
+    result->samples = other->samples;
+    result->sample_count = other->sample_count;
+    result->sample_capacity = other->sample_capacity;
+    return;
+  }
+
+  size_t count = result->sample_count + other->sample_count;
+
+  if (count > result->sample_capacity) {
+    double* samples =
+        (double*)realloc(result->samples, count * sizeof(double));
+    if (!samples) {
+      free(other->samples);
+      return;
+    }
+    result->samples = samples;
+    result->sample_capacity = count;
+  }
+
+  memcpy(result->samples + result->sample_count, other->samples,
+         other->sample_count * sizeof(double));
+  result->sample_count = count;
+  free(other->samples);
+}
+
+static int bench_compare_double(const void* a, const void* b) {
+  double x = *(const double*)a;
+  double y = *(const double*)b;
+  return (x > y) - (x < y);
+}
+
+static double bench_percentile(double* sorted, size_t count, double p) {
+  if (count == 0) {
+    return 0.0;
+  }
+
+  size_t index = (size_t)(p * (double)(count - 1) + 0.5);
+  return sorted[index];
+}
+
+/* Subjects */
+
+typedef struct bench_buffer_state {
+  union {
+    arena_allocator arena;
+    virtual_arena_allocator virtual_arena;
+    pool_allocator pool;
+    stack_allocator stack;
+    scratch_allocator scratch;
+    freelist_allocator freelist;
+    tcache_allocator tcache;
+    concurrent_pool_allocator concurrent_pool;
+    slab_allocator slab;
+  } u;
+  void* buffer;
+} bench_buffer_state;
+
+#define BENCH_CHUNK_SIZE 64
+#define BENCH_POOL_CHUNKS ((size_t)64 * 1024)
+#define BENCH_HEAP_SIZE ((size_t)256 * 1024 * 1024)
+
+static bench_buffer_state* bench_state(bench_subject* subject,
+                                       size_t buffer_size) {
+  bench_buffer_state* state =
+      (bench_buffer_state*)calloc(1, sizeof(bench_buffer_state));
+
+  if (!state) {
+    return NULL;
+  }
+
+  if (buffer_size) {
+    state->buffer = malloc(buffer_size);
+    if (!state->buffer) {
+      free(state);
+      return NULL;
+    }
+  }
+
+  subject->state = state;
+  return state;
+}
+
+static void bench_state_free(bench_subject* subject) {
+  bench_buffer_state* state = (bench_buffer_state*)subject->state;
+  free(state->buffer);
+  free(state);
+  subject->state = NULL;
+}
+
+static int bench_c_create(bench_subject* subject, size_t threads) {
+  (void)threads;
+  subject->alloc = *c_allocator();
+  return 1;
+}
+
+static void bench_noop(bench_subject* subject) { (void)subject; }
+
+#if defined(BENCH_MIMALLOC)
+static void* bench_mi_alloc(allocator* self, size_t size, size_t alignment) {
+  (void)self;
+  return mi_malloc_aligned(size, alignment);
+}
+
+static void* bench_mi_realloc(allocator* self, void* ptr, size_t old_size,
+                              size_t new_size, size_t alignment) {
+  (void)self;
+  (void)old_size;
+  return mi_realloc_aligned(ptr, new_size, alignment);
+}
+
+static void bench_mi_free(allocator* self, void* ptr, size_t size) {
+  (void)self;
+  (void)size;
+  mi_free(ptr);
+}
+
+static int bench_mi_create(bench_subject* subject, size_t threads) {
+  (void)threads;
+  allocator alloc = {.alloc = bench_mi_alloc,
+                     .realloc = bench_mi_realloc,
+                     .free = bench_mi_free};
+  subject->alloc = alloc;
+  return 1;
+}
+#endif
+
+#if defined(BENCH_JEMALLOC)
+static void* bench_je_alloc(allocator* self, size_t size, size_t alignment) {
+  (void)self;
+  return mallocx(size, MALLOCX_ALIGN(alignment));
+}
+
+static void* bench_je_realloc(allocator* self, void* ptr, size_t old_size,
+                              size_t new_size, size_t alignment) {
+  (void)self;
+  (void)old_size;
+  if (!ptr) {
+    return mallocx(new_size, MALLOCX_ALIGN(alignment));
+  }
+  return rallocx(ptr, new_size, MALLOCX_ALIGN(alignment));
+}
+
+static void bench_je_free(allocator* self, void* ptr, size_t size) {
+  (void)self;
+  if (ptr) {
+    sdallocx(ptr, size, 0);
+  }
+}
+
+static int bench_je_create(bench_subject* subject, size_t threads) {
+  (void)threads;
+  allocator alloc = {.alloc = bench_je_alloc,
+                     .realloc = bench_je_realloc,
+                     .free = bench_je_free};
+  subject->alloc = alloc;
+  return 1;
+}
+#endif
+
+static int bench_arena_create(bench_subject* subject, size_t threads) {
+  (void)threads;
+  bench_buffer_state* state = bench_state(subject, 0);
+  if (!state) {
+    return 0;
+  }
+  arena_allocator_init_growable(&state->u.arena, c_allocator(), 64 * 1024,
+                                16 * 1024 * 1024);
+  subject->alloc = arena_allocator_get(&state->u.arena);
+  return 1;
+}
+
+static void bench_arena_reset(bench_subject* subject) {
+  arena_allocator_reset(&((bench_buffer_state*)subject->state)->u.arena);
+}
+
+static void bench_arena_destroy(bench_subject* subject) {
+  arena_allocator_destroy(&((bench_buffer_state*)subject->state)->u.arena);
+  bench_state_free(subject);
+}
+
+static int bench_virtual_arena_create(bench_subject* subject,
+                                      size_t threads) {
+  (void)threads;
+  bench_buffer_state* state = bench_state(subject, 0);
+  if (!state || !virtual_arena_allocator_init(&state->u.virtual_arena,
+                                              BENCH_HEAP_SIZE)) {
+    if (state) {
+      bench_state_free(subject);
+    }
+    return 0;
+  }
+  subject->alloc = virtual_arena_allocator_get(&state->u.virtual_arena);
+  return 1;
+}
+
+static void bench_virtual_arena_reset(bench_subject* subject) {
+  virtual_arena_allocator_reset(
+      &((bench_buffer_state*)subject->state)->u.virtual_arena);
+}
+
+static void bench_virtual_arena_destroy(bench_subject* subject) {
+  virtual_arena_allocator_destroy(
+      &((bench_buffer_state*)subject->state)->u.virtual_arena);
+  bench_state_free(subject);
+}
+
+static int bench_pool_create(bench_subject* subject, size_t threads) {
+  (void)threads;
+  bench_buffer_state* state =
+      bench_state(subject, BENCH_CHUNK_SIZE * BENCH_POOL_CHUNKS);
+  if (!state) {
+    return 0;
+  }
+  pool_allocator_init(&state->u.pool, state->buffer, BENCH_CHUNK_SIZE,
+                      BENCH_POOL_CHUNKS);
+  subject->alloc = pool_allocator_get(&state->u.pool);
+  return 1;
+}
+
+static int bench_stack_create(bench_subject* subject, size_t threads) {
+  (void)threads;
+  bench_buffer_state* state = bench_state(subject, BENCH_HEAP_SIZE);
+  if (!state) {
+    return 0;
+  }
+  stack_allocator_init(&state->u.stack, state->buffer, BENCH_HEAP_SIZE);
+  subject->alloc = stack_allocator_get(&state->u.stack);
+  return 1;
+}
+
+static void bench_stack_reset(bench_subject* subject) {
+  stack_allocator_reset(&((bench_buffer_state*)subject->state)->u.stack);
+}
+
+static int bench_scratch_create(bench_subject* subject, size_t threads) {
+  (void)threads;
+  bench_buffer_state* state = bench_state(subject, 0);
+  if (!state) {
+    return 0;
+  }
+  scratch_allocator_init_chunked(&state->u.scratch, c_allocator(), 64 * 1024);
+  subject->alloc = scratch_allocator_get(&state->u.scratch);
+  return 1;
+}
+
+static void bench_scratch_reset(bench_subject* subject) {
+  scratch_allocator_reset(&((bench_buffer_state*)subject->state)->u.scratch);
+}
+
+static void bench_scratch_destroy(bench_subject* subject) {
+  scratch_allocator_destroy(
+      &((bench_buffer_state*)subject->state)->u.scratch);
+  bench_state_free(subject);
+}
+
+static int bench_freelist_create(bench_subject* subject, size_t threads) {
+  (void)threads;
+  bench_buffer_state* state = bench_state(subject, BENCH_HEAP_SIZE);
+  if (!state) {
+    return 0;
+  }
+  freelist_allocator_init(&state->u.freelist, state->buffer, BENCH_HEAP_SIZE);
+  subject->alloc = freelist_allocator_get(&state->u.freelist);
+  return 1;
+}
+
+static int bench_slab_create(bench_subject* subject, size_t threads) {
+  (void)threads;
+  bench_buffer_state* state = bench_state(subject, 0);
+  if (!state) {
+    return 0;
+  }
+  slab_allocator_init(&state->u.slab, c_allocator(), NULL, 0, 0);
+  subject->alloc = slab_allocator_get(&state->u.slab);
+  return 1;
+}
+
+static void bench_slab_destroy(bench_subject* subject) {
+  slab_allocator_destroy(&((bench_buffer_state*)subject->state)->u.slab);
+  bench_state_free(subject);
+}
+
+static int bench_tcache_create(bench_subject* subject, size_t threads) {
+  (void)threads;
+  bench_buffer_state* state = bench_state(subject, 0);
+  if (!state) {
+    return 0;
+  }
+  tcache_allocator_init(&state->u.tcache, c_allocator());
+  subject->alloc = tcache_allocator_get(&state->u.tcache);
+  return 1;
+}
+
+static void bench_tcache_destroy(bench_subject* subject) {
+  tcache_allocator_destroy(&((bench_buffer_state*)subject->state)->u.tcache);
+  bench_state_free(subject);
+}
+
+static int bench_concurrent_pool_create(bench_subject* subject,
+                                        size_t threads) {
+  size_t chunks = BENCH_POOL_CHUNKS * (threads ? threads : 1);
+  bench_buffer_state* state = bench_state(subject, BENCH_CHUNK_SIZE * chunks);
+  if (!state) {
+    return 0;
+  }
+  concurrent_pool_allocator_init(&state->u.concurrent_pool, state->buffer,
+                                 BENCH_CHUNK_SIZE, chunks);
+  subject->alloc = concurrent_pool_allocator_get(&state->u.concurrent_pool);
+  return 1;
+}
+
+static bench_subject bench_subjects[] = {
+    {.name = "c",
+     .flags = BENCH_GENERAL | BENCH_THREAD_SAFE,
+     .create = bench_c_create,
+     .reset = bench_noop,
+     .destroy = bench_noop},
+#if defined(BENCH_MIMALLOC)
+    {.name = "mimalloc",
+     .flags = BENCH_GENERAL | BENCH_THREAD_SAFE,
+     .create = bench_mi_create,
+     .reset = bench_noop,
+     .destroy = bench_noop},
+#endif
+#if defined(BENCH_JEMALLOC)
+    {.name = "jemalloc",
+     .flags = BENCH_GENERAL | BENCH_THREAD_SAFE,
+     .create = bench_je_create,
+     .reset = bench_noop,
+     .destroy = bench_noop},
+#endif
+    {.name = "arena",
+     .flags = BENCH_RESET | BENCH_REALLOC | BENCH_VARIABLE_SIZE,
+     .create = bench_arena_create,
+     .reset = bench_arena_reset,
+     .destroy = bench_arena_destroy},
+    {.name = "virtual_arena",
+     .flags = BENCH_RESET | BENCH_REALLOC | BENCH_VARIABLE_SIZE,
+     .create = bench_virtual_arena_create,
+     .reset = bench_virtual_arena_reset,
+     .destroy = bench_virtual_arena_destroy},
+    {.name = "pool",
+     .flags = BENCH_FREE_ANY | BENCH_FREE_LIFO,
+     .create = bench_pool_create,
+     .reset = bench_noop,
+     .destroy = bench_state_free},
+    {.name = "stack",
+     .flags =
+         BENCH_FREE_LIFO | BENCH_RESET | BENCH_REALLOC | BENCH_VARIABLE_SIZE,
+     .create = bench_stack_create,
+     .reset = bench_stack_reset,
+     .destroy = bench_state_free},
+    {.name = "scratch",
+     .flags = BENCH_RESET | BENCH_REALLOC | BENCH_VARIABLE_SIZE,
+     .create = bench_scratch_create,
+     .reset = bench_scratch_reset,
+     .destroy = bench_scratch_destroy},
+    {.name = "freelist",
+     .flags = BENCH_GENERAL,
+     .create = bench_freelist_create,
+     .reset = bench_noop,
+     .destroy = bench_state_free},
+    {.name = "slab",
+     .flags = BENCH_GENERAL,
+     .create = bench_slab_create,
+     .reset = bench_noop,
+     .destroy = bench_slab_destroy},
+    {.name = "tcache",
+     .flags = BENCH_GENERAL | BENCH_THREAD_SAFE,
+     .create = bench_tcache_create,
+     .reset = bench_noop,
+     .destroy = bench_tcache_destroy},
+    {.name = "concurrent_pool",
+     .flags = BENCH_FREE_ANY | BENCH_FREE_LIFO | BENCH_THREAD_SAFE,
+     .create = bench_concurrent_pool_create,
+     .reset = bench_noop,
+     .destroy = bench_state_free},
+};
+
+#define BENCH_SUBJECT_COUNT \
+  (sizeof(bench_subjects) / sizeof(bench_subjects[0]))
+
+/* Workloads. Each runs one repetition and reports ops and per-batch
+   latency samples. */
+
+typedef struct bench_workload {
+  const char* name;
+  int required;
+  int threaded;
+  void (*run)(bench_subject* subject, size_t scale, bench_result* result);
+} bench_workload;
+
+#define BENCH_LIVE 1024
+
+static void bench_churn(bench_subject* subject, size_t scale,
+                        bench_result* result) {
+  void* ptrs[BENCH_LIVE];
+  size_t rounds = 64 * scale;
+
+  for (size_t round = 0; round < rounds; round++) {
+    for (size_t i = 0; i < BENCH_LIVE; i += BENCH_BATCH) {
+      uint64_t start = bench_time_ns();
+      for (size_t j = i; j < i + BENCH_BATCH; j++) {
+        ptrs[j] = alloc_alloc(&subject->alloc, BENCH_CHUNK_SIZE, 8);
+      }
+      bench_sample(result, bench_time_ns() - start, BENCH_BATCH);
+    }
+
+    for (size_t i = BENCH_LIVE; i > 0; i -= BENCH_BATCH) {
+      uint64_t start = bench_time_ns();
+      for (size_t j = i; j > i - BENCH_BATCH; j--) {
+        alloc_free(&subject->alloc, ptrs[j - 1], BENCH_CHUNK_SIZE);
+      }
+      bench_sample(result, bench_time_ns() - start, BENCH_BATCH);
+    }
+  }
+
+  result->ops += (double)(rounds * BENCH_LIVE * 2);
+}
+
+static void bench_random_sizes(bench_subject* subject, size_t scale,
+                               bench_result* result) {
+  void* ptrs[BENCH_LIVE];
+  size_t sizes[BENCH_LIVE];
+  uint64_t rng = BENCH_SEED;
+
+  for (size_t i = 0; i < BENCH_LIVE; i++) {
+    sizes[i] = bench_random_size(&rng, 16, 1024);
+    ptrs[i] = alloc_alloc(&subject->alloc, sizes[i], 8);
+  }
+
+  size_t iterations = 64 * 1024 * scale;
+
+  for (size_t i = 0; i < iterations; i += BENCH_BATCH) {
+    uint64_t start = bench_time_ns();
+    for (size_t j = 0; j < BENCH_BATCH; j++) {
+      size_t slot = (size_t)(bench_random(&rng) % BENCH_LIVE);
+      alloc_free(&subject->alloc, ptrs[slot], sizes[slot]);
+      sizes[slot] = bench_random_size(&rng, 16, 1024);
+      ptrs[slot] = alloc_alloc(&subject->alloc, sizes[slot], 8);
+    }
+    bench_sample(result, bench_time_ns() - start, BENCH_BATCH * 2);
+  }
+
+  for (size_t i = 0; i < BENCH_LIVE; i++) {
+    alloc_free(&subject->alloc, ptrs[i], sizes[i]);
+  }
+
+  result->ops += (double)(iterations * 2);
+}
+
+static void bench_realloc_growth(bench_subject* subject, size_t scale,
+                                 bench_result* result) {
+  size_t rounds = 256 * scale;
+  size_t steps = 0;
+
+  for (size_t round = 0; round < rounds; round++) {
+    size_t size = 16;
+    void* ptr = alloc_alloc(&subject->alloc, size, 16);
+
+    uint64_t start = bench_time_ns();
+    while (ptr && size < 64 * 1024) {
+      ptr = alloc_realloc(&subject->alloc, ptr, size, size * 2, 16);
+      size *= 2;
+      steps++;
+    }
+    bench_sample(result, bench_time_ns() - start, 12);
+
+    alloc_free(&subject->alloc, ptr, size);
+    subject->reset(subject);
+  }
+
+  result->ops += (double)steps;
+}
+
+static void bench_reset_cycle(bench_subject* subject, size_t scale,
+                              bench_result* result) {
+  size_t rounds = 256 * scale;
+  uint64_t rng = BENCH_SEED;
+
+  for (size_t round = 0; round < rounds; round++) {
+    uint64_t start = bench_time_ns();
+    for (size_t i = 0; i < BENCH_LIVE; i++) {
+      alloc_alloc(&subject->alloc, bench_random_size(&rng, 8, 256), 8);
+    }
+    subject->reset(subject);
+    bench_sample(result, bench_time_ns() - start, BENCH_LIVE + 1);
+  }
+
+  result->ops += (double)(rounds * (BENCH_LIVE + 1));
+}
+
+/* Threads */
+
+#if defined(_WIN32)
+typedef HANDLE bench_thread;
+#else
+typedef pthread_t bench_thread;
+#endif
+
+typedef struct bench_thread_arg {
+  bench_subject* subject;
+  size_t scale;
+  bench_result result;
+  void (*run)(bench_subject* subject, size_t scale, bench_result* result);
+} bench_thread_arg;
+
+#if defined(_WIN32)
+static DWORD WINAPI bench_thread_main(LPVOID param) {
+#else
+static void* bench_thread_main(void* param) {
+#endif
+  bench_thread_arg* arg = (bench_thread_arg*)param;
+  arg->run(arg->subject, arg->scale, &arg->result);
+  return 0;
+}
+
+static int bench_thread_start(bench_thread* thread, bench_thread_arg* arg) {
+#if defined(_WIN32)
+  *thread = CreateThread(NULL, 0, bench_thread_main, arg, 0, NULL);
+  return *thread != NULL;
+#else
+  return pthread_create(thread, NULL, bench_thread_main, arg) == 0;
+#endif
+}
+
+static void bench_thread_join(bench_thread thread) {
+#if defined(_WIN32)
+  WaitForSingleObject(thread, INFINITE);
+  CloseHandle(thread);
+#else
+  pthread_join(thread, NULL);
+#endif
+}
+
+#define BENCH_RING_SIZE 1024
+
+typedef struct bench_ring {
+  void* slots[BENCH_RING_SIZE];
+  ALLOC_ATOMIC(size_t) head;
+  ALLOC_ATOMIC(size_t) tail;
+  size_t total;
+  bench_subject* subject;
+} bench_ring;
+
+#if defined(_WIN32)
+static DWORD WINAPI bench_consumer_main(LPVOID param) {
+#else
+static void* bench_consumer_main(void* param) {
+#endif
+  bench_ring* ring = (bench_ring*)param;
+
+  for (size_t consumed = 0; consumed < ring->total; consumed++) {
+    size_t tail = atomic_load_explicit(&ring->tail, memory_order_relaxed);
+    while (atomic_load_explicit(&ring->head, memory_order_acquire) == tail) {
+      bench_yield();
+    }
+    void* ptr = ring->slots[tail % BENCH_RING_SIZE];
+    atomic_store_explicit(&ring->tail, tail + 1, memory_order_release);
+    alloc_free(&ring->subject->alloc, ptr, BENCH_CHUNK_SIZE);
+  }
+
+  return 0;
+}
+
+static void bench_producer_consumer(bench_subject* subject, size_t scale,
+                                    bench_result* result) {
+  bench_ring* ring = (bench_ring*)calloc(1, sizeof(bench_ring));
+  if (!ring) {
+    return;
+  }
+
+  ring->total = 256 * 1024 * scale;
+  ring->subject = subject;
+  atomic_init(&ring->head, (size_t)0);
+  atomic_init(&ring->tail, (size_t)0);
+
+  bench_thread consumer;
+#if defined(_WIN32)
+  consumer = CreateThread(NULL, 0, bench_consumer_main, ring, 0, NULL);
+  if (!consumer) {
+    free(ring);
+    return;
+  }
+#else
+  if (pthread_create(&consumer, NULL, bench_consumer_main, ring) != 0) {
+    free(ring);
+    return;
+  }
+#endif
+
+  for (size_t produced = 0; produced < ring->total;
+       produced += BENCH_BATCH) {
+    uint64_t start = bench_time_ns();
+    for (size_t i = 0; i < BENCH_BATCH; i++) {
+      void* ptr = alloc_alloc(&subject->alloc, BENCH_CHUNK_SIZE, 8);
+      size_t head = atomic_load_explicit(&ring->head, memory_order_relaxed);
+      while (head - atomic_load_explicit(&ring->tail, memory_order_acquire) ==
+             BENCH_RING_SIZE) {
+        bench_yield();
+      }
+      ring->slots[head % BENCH_RING_SIZE] = ptr;
+      atomic_store_explicit(&ring->head, head + 1, memory_order_release);
+    }
+    bench_sample(result, bench_time_ns() - start, BENCH_BATCH);
+  }
+
+  bench_thread_join(consumer);
+  result->ops += (double)(ring->total * 2);
+  free(ring);
+}
+
+static const bench_workload bench_workloads[] = {
+    {"churn", BENCH_FREE_LIFO, 0, bench_churn},
+    {"random_size", BENCH_FREE_ANY | BENCH_VARIABLE_SIZE, 0,
+     bench_random_sizes},
+    {"realloc_growth", BENCH_REALLOC | BENCH_VARIABLE_SIZE, 0,
+     bench_realloc_growth},
+    {"reset_cycle", BENCH_RESET | BENCH_VARIABLE_SIZE, 0, bench_reset_cycle},
+    {"producer_consumer", BENCH_THREAD_SAFE, 0, bench_producer_consumer},
+    {"threaded_churn", BENCH_THREAD_SAFE, 1, bench_churn},
+};
+
+#define BENCH_WORKLOAD_COUNT \
+  (sizeof(bench_workloads) / sizeof(bench_workloads[0]))
+
+static int bench_run(const bench_workload* workload, bench_subject* subject,
+                     size_t threads, size_t scale, bench_result* result) {
+  bench_thread_arg args[BENCH_MAX_THREADS];
+  bench_thread handles[BENCH_MAX_THREADS];
+
+  if (!subject->create(subject, threads)) {
+    return 0;
+  }
+
+  memset(args, 0, sizeof(args));
+
+  for (size_t i = 0; i < threads; i++) {
+    args[i].subject = subject;
+    args[i].scale = scale;
+    args[i].run = workload->run;
+  }
+
+  uint64_t start = bench_time_ns();
+
+  if (workload->threaded) {
+    size_t started = 0;
+    for (; started < threads; started++) {
+      if (!bench_thread_start(&handles[started], &args[started])) {
+        break;
+      }
+    }
+    for (size_t i = 0; i < started; i++) {
+      bench_thread_join(handles[i]);
+    }
+  } else {
+    workload->run(subject, scale, &args[0].result);
+  }
+
+  result->seconds = (double)(bench_time_ns() - start) / 1e9;
+
+  for (size_t i = 0; i < threads; i++) {
+    result->ops += args[i].result.ops;
+    bench_merge(result, &args[i].result);
+  }
+
+  subject->destroy(subject);
+  return 1;
+}
+
+static int bench_matches(const char* filter, const char* name) {
+  return !filter || strstr(name, filter) != NULL;
+}
+
+static void bench_report(const bench_workload* workload,
+                         bench_subject* subject, size_t threads,
+                         size_t scale) {
+  double rates[BENCH_REPEATS];
+  bench_result best;
+  memset(&best, 0, sizeof(best));
+
+  size_t repeats = 0;
+
+  for (size_t repeat = 0; repeat < BENCH_REPEATS; repeat++) {
+    bench_result result;
+    memset(&result, 0, sizeof(result));
+
+    if (!bench_run(workload, subject, threads, scale, &result) ||
+        result.seconds <= 0.0) {
+      free(result.samples);
+      continue;
+    }
+
+    rates[repeats++] = result.ops / result.seconds;
+
+    if (!best.samples || result.seconds < best.seconds) {
+      free(best.samples);
+      best = result;
+    } else {
+      free(result.samples);
+    }
+  }
+
+  if (repeats == 0) {
+    printf("%s,%s,%zu,0,0,0,0,0,0\n", workload->name, subject->name,
+           threads);
+    return;
+  }
+
+  qsort(rates, repeats, sizeof(double), bench_compare_double);
+  qsort(best.samples, best.sample_count, sizeof(double),
+        bench_compare_double);
+
+  printf("%s,%s,%zu,%.0f,%.6f,%.0f,%.1f,%.1f,%.1f\n", workload->name,
+         subject->name, threads, best.ops, best.seconds, rates[repeats / 2],
+         bench_percentile(best.samples, best.sample_count, 0.50),
+         bench_percentile(best.samples, best.sample_count, 0.99),
+         bench_percentile(best.samples, best.sample_count, 0.999));
+  fflush(stdout);
+
+  free(best.samples);
+}
+
+int main(int argc, char** argv) {
+  const char* filter = NULL;
+  size_t scale = 1;
+  size_t max_threads = 8;
+
+  for (int i = 1; i < argc; i++) {
+    if (strcmp(argv[i], "--filter") == 0 && i + 1 < argc) {
+      filter = argv[++i];
+    } else if (strcmp(argv[i], "--scale") == 0 && i + 1 < argc) {
+      scale = (size_t)strtoul(argv[++i], NULL, 10);
+    } else if (strcmp(argv[i], "--threads") == 0 && i + 1 < argc) {
+      max_threads = (size_t)strtoul(argv[++i], NULL, 10);
+    } else {
+      fprintf(stderr,
+              "usage: %s [--filter name] [--scale n] [--threads n]\n",
+              argv[0]);
+      return 1;
+    }
+  }
+
+  if (scale == 0) {
+    scale = 1;
+  }
+
+  if (max_threads == 0 || max_threads > BENCH_MAX_THREADS) {
+    max_threads = BENCH_MAX_THREADS;
+  }
+
+  printf("workload,allocator,threads,ops,seconds,ops_per_sec,p50_ns,p99_ns,"
+         "p999_ns\n");
+
+  for (size_t w = 0; w < BENCH_WORKLOAD_COUNT; w++) {
+    const bench_workload* workload = &bench_workloads[w];
+
+    for (size_t s = 0; s < BENCH_SUBJECT_COUNT; s++) {
+      bench_subject* subject = &bench_subjects[s];
+
+      if ((subject->flags & workload->required) != workload->required) {
+        continue;
+      }
+
+      if (!bench_matches(filter, workload->name) &&
+          !bench_matches(filter, subject->name)) {
+        continue;
+      }
+
+      if (workload->threaded) {
+        for (size_t threads = 1; threads <= max_threads; threads *= 2) {
+          bench_report(workload, subject, threads, scale);
+        }
+      } else {
+        bench_report(workload, subject, 1, scale);
+      }
+    }
+  }
+
+  return 0;
+}
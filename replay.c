@@ -0,0 +1,683 @@
+#include "alloc.h"
+
+#define REPLAY_REPEATS 3
+#define REPLAY_MIN_HEAP ((size_t)1 << 20)
+#define REPLAY_SLOT_NONE UINT32_MAX
+
+typedef struct replay_op {
+  uint8_t op;
+  uint8_t alignment_log2;
+  uint32_t slot;
+  size_t size;
+} replay_op;
+
+typedef struct replay_trace {
+  replay_op* ops;
+  size_t op_count;
+  size_t slot_count;
+  size_t peak_live;
+  size_t max_size;
+  size_t max_alignment;
+} replay_trace;
+
+/* Backing allocator that records how much memory a subject holds. Sizes are
+   taken from malloc_usable_size where available, so the c subject is charged
+   for its own rounding. */
+typedef struct replay_counter {
+  size_t current;
+  size_t peak;
+} replay_counter;
+
+static size_t replay_counter_size(void* ptr, size_t size) {
+  size_t usable = c_allocator_usable_size(ptr);
+  return usable ? usable : size;
+}
+
+static void replay_counter_add(replay_counter* counter, size_t bytes) {
+  counter->current += bytes;
+  if (counter->current > counter->peak) {
+    counter->peak = counter->current;
+  }
+}
+
+static void* replay_counter_alloc(allocator* self, size_t size,
+                                  size_t alignment) {
+  replay_counter* counter = (replay_counter*)self->ctx;
+  void* ptr = alloc_alloc(c_allocator(), size, alignment);
+
+  if (ptr) {
+    replay_counter_add(counter, replay_counter_size(ptr, size));
+  }
+
+  return ptr;
+}
+
+static void* replay_counter_realloc(allocator* self, void* ptr,
+                                    size_t old_size, size_t new_size,
+                                    size_t alignment) {
+  replay_counter* counter = (replay_counter*)self->ctx;
+  size_t old_bytes = ptr ? replay_counter_size(ptr, old_size) : 0;
+  void* new_ptr =
+      alloc_realloc(c_allocator(), ptr, old_size, new_size, alignment);
+
+  if (new_ptr) {
+    counter->current -= old_bytes;
+    replay_counter_add(counter, replay_counter_size(new_ptr, new_size));
+  }
+
+  return new_ptr;
+}
+
+static void replay_counter_free(allocator* self, void* ptr, size_t size) {
+  replay_counter* counter = (replay_counter*)self->ctx;
+
+  if (!ptr)
+    return;
+
+  counter->current -= replay_counter_size(ptr, size);
+  alloc_free(c_allocator(), ptr, size);
+}
+
+/* Subjects */
+
+typedef struct replay_subject replay_subject;
+
+struct replay_subject {
+  const char* name;
+  int (*create)(replay_subject* subject, const replay_trace* trace);
+  size_t (*usage)(replay_subject* subject);
+  void (*destroy)(replay_subject* subject);
+  allocator alloc;
+  allocator backing;
+  replay_counter counter;
+  union {
+    arena_allocator arena;
+    pool_allocator pool;
+    freelist_allocator freelist;
+    buddy_allocator buddy;
+    slab_allocator slab;
+    tcache_allocator tcache;
+    heap_allocator heap;
+  } u;
+  void* buffer;
+  size_t buffer_size;
+};
+
+static size_t replay_heap_size(const replay_trace* trace) {
+  size_t size = REPLAY_MIN_HEAP;
+  while (size < 4 * trace->peak_live) {
+    size <<= 1;
+  }
+  return size;
+}
+
+static size_t replay_counter_usage(replay_subject* subject) {
+  return subject->counter.current;
+}
+
+static void replay_noop(replay_subject* subject) { (void)subject; }
+
+static int replay_c_create(replay_subject* subject,
+                           const replay_trace* trace) {
+  (void)trace;
+  subject->alloc = subject->backing;
+  return 1;
+}
+
+static int replay_arena_create(replay_subject* subject,
+                               const replay_trace* trace) {
+  (void)trace;
+  arena_allocator_init_growable(&subject->u.arena, &subject->backing,
+                                64 * 1024, 16 * 1024 * 1024);
+  subject->alloc = arena_allocator_get(&subject->u.arena);
+  return 1;
+}
+
+static void replay_arena_destroy(replay_subject* subject) {
+  arena_allocator_destroy(&subject->u.arena);
+}
+
+/* One pool sized for the largest request shows what a single chunk size
+   would cost on this trace. */
+static int replay_pool_create(replay_subject* subject,
+                              const replay_trace* trace) {
+  if (trace->max_size > 64 * 1024) {
+    return 0;
+  }
+
+  pool_allocator_init_growable(&subject->u.pool, &subject->backing,
+                               trace->max_size ? trace->max_size : 1, 256,
+                               trace->max_alignment);
+  subject->alloc = pool_allocator_get(&subject->u.pool);
+  return 1;
+}
+
+static void replay_pool_destroy(replay_subject* subject) {
+  pool_allocator_destroy(&subject->u.pool);
+}
+
+static int replay_freelist_create(replay_subject* subject,
+                                  const replay_trace* trace) {
+  subject->buffer_size = replay_heap_size(trace);
+  subject->buffer = alloc_alloc(&subject->backing, subject->buffer_size, 64);
+  if (!subject->buffer) {
+    return 0;
+  }
+
+  freelist_allocator_init(&subject->u.freelist, subject->buffer,
+                          subject->buffer_size);
+  subject->alloc = freelist_allocator_get(&subject->u.freelist);
+  return 1;
+}
+
+static size_t replay_freelist_usage(replay_subject* subject) {
+  freelist_allocator* freelist = &subject->u.freelist;
+  return (size_t)(freelist->heap_end - freelist->heap_start) -
+         freelist->free_bytes;
+}
+
+static void replay_freelist_destroy(replay_subject* subject) {
+  alloc_free(&subject->backing, subject->buffer, subject->buffer_size);
+}
+
+static int replay_buddy_create(replay_subject* subject,
+                               const replay_trace* trace) {
+  if (!buddy_allocator_init_backing(&subject->u.buddy, &subject->backing,
+                                    replay_heap_size(trace), 16)) {
+    return 0;
+  }
+
+  subject->alloc = buddy_allocator_get(&subject->u.buddy);
+  return 1;
+}
+
+static size_t replay_buddy_usage(replay_subject* subject) {
+  return subject->u.buddy.size - subject->u.buddy.free_bytes;
+}
+
+static void replay_buddy_destroy(replay_subject* subject) {
+  buddy_allocator_destroy(&subject->u.buddy);
+}
+
+static int replay_slab_create(replay_subject* subject,
+                              const replay_trace* trace) {
+  (void)trace;
+  slab_allocator_init(&subject->u.slab, &subject->backing, NULL, 0, 0);
+  subject->alloc = slab_allocator_get(&subject->u.slab);
+  return 1;
+}
+
+static void replay_slab_destroy(replay_subject* subject) {
+  slab_allocator_destroy(&subject->u.slab);
+}
+
+static int replay_tcache_create(replay_subject* subject,
+                                const replay_trace* trace) {
+  (void)trace;
+  tcache_allocator_init(&subject->u.tcache, &subject->backing);
+  subject->alloc = tcache_allocator_get(&subject->u.tcache);
+  return 1;
+}
+
+static void replay_tcache_destroy(replay_subject* subject) {
+  tcache_allocator_destroy(&subject->u.tcache);
+}
+
+static int replay_heap_create(replay_subject* subject,
+                              const replay_trace* trace) {
+  (void)trace;
+  heap_allocator_init(&subject->u.heap, &subject->backing);
+  subject->alloc = heap_allocator_get(&subject->u.heap);
+  return 1;
+}
+
+static void replay_heap_destroy(replay_subject* subject) {
+  heap_allocator_destroy(&subject->u.heap);
+}
+
+static replay_subject replay_subjects[] = {
+    {.name = "c",
+     .create = replay_c_create,
+     .usage = replay_counter_usage,
+     .destroy = replay_noop},
+    {.name = "arena",
+     .create = replay_arena_create,
+     .usage = replay_counter_usage,
+     .destroy = replay_arena_destroy},
+    {.name = "pool",
+     .create = replay_pool_create,
+     .usage = replay_counter_usage,
+     .destroy = replay_pool_destroy},
+    {.name = "freelist",
+     .create = replay_freelist_create,
+     .usage = replay_freelist_usage,
+     .destroy = replay_freelist_destroy},
+    {.name = "buddy",
+     .create = replay_buddy_create,
+     .usage = replay_buddy_usage,
+     .destroy = replay_buddy_destroy},
+    {.name = "slab",
+     .create = replay_slab_create,
+     .usage = replay_counter_usage,
+     .destroy = replay_slab_destroy},
+    {.name = "tcache",
+     .create = replay_tcache_create,
+     .usage = replay_counter_usage,
+     .destroy = replay_tcache_destroy},
+    {.name = "heap",
+     .create = replay_heap_create,
+     .usage = replay_counter_usage,
+     .destroy = replay_heap_destroy},
+};
+
+#define REPLAY_SUBJECT_COUNT \
+  (sizeof(replay_subjects) / sizeof(replay_subjects[0]))
+
+/* Loading. Records from all threads are merged by timestamp and turned into
+   ops on dense object slots, so replay indexes an array instead of hashing
+   pointers. */
+
+static trace_record* replay_sort_base;
+
+static int replay_compare_records(const void* a, const void* b) {
+  const trace_record* x = &replay_sort_base[*(const size_t*)a];
+  const trace_record* y = &replay_sort_base[*(const size_t*)b];
+
+  if (x->timestamp != y->timestamp) {
+    return x->timestamp < y->timestamp ? -1 : 1;
+  }
+  if (x->thread != y->thread) {
+    return x->thread < y->thread ? -1 : 1;
+  }
+  return (*(const size_t*)a > *(const size_t*)b) -
+         (*(const size_t*)a < *(const size_t*)b);
+}
+
+typedef struct replay_map {
+  uint64_t* keys;
+  uint32_t* slots;
+  size_t mask;
+} replay_map;
+
+#define REPLAY_KEY_EMPTY ((uint64_t)0)
+#define REPLAY_KEY_DELETED ((uint64_t)1)
+
+static size_t replay_map_find(replay_map* map, uint64_t key) {
+  size_t i = (size_t)((key >> 4) * 0x9e3779b97f4a7c15ull) & map->mask;
+
+  while (map->keys[i] != REPLAY_KEY_EMPTY) {
+    if (map->keys[i] == key) {
+      return i;
+    }
+    i = (i + 1) & map->mask;
+  }
+
+  return map->mask + 1;
+}
+
+static void replay_map_insert(replay_map* map, uint64_t key, uint32_t slot) {
+  size_t i = (size_t)((key >> 4) * 0x9e3779b97f4a7c15ull) & map->mask;
+
+  while (map->keys[i] != REPLAY_KEY_EMPTY &&
+         map->keys[i] != REPLAY_KEY_DELETED) {
+    i = (i + 1) & map->mask;
+  }
+
+  map->keys[i] = key;
+  map->slots[i] = slot;
+}
+
+static uint32_t replay_map_remove(replay_map* map, uint64_t key) {
+  size_t i = replay_map_find(map, key);
+
+  if (i > map->mask) {
+    return REPLAY_SLOT_NONE;
+  }
+
+  map->keys[i] = REPLAY_KEY_DELETED;
+  return map->slots[i];
+}
+
+static trace_record* replay_read(const char* path, size_t* count) {
+  FILE* file = fopen(path, "rb");
+  trace_file_header header;
+
+  if (!file) {
+    fprintf(stderr, "replay: cannot open %s\n", path);
+    return NULL;
+  }
+
+  if (fread(&header, sizeof(header), 1, file) != 1 ||
+      header.magic != TRACE_MAGIC || header.version != TRACE_VERSION ||
+      header.record_size != sizeof(trace_record)) {
+    fprintf(stderr, "replay: %s is not a version %d trace\n", path,
+            TRACE_VERSION);
+    fclose(file);
+    return NULL;
+  }
+
+  size_t capacity = 0;
+  trace_record* records = NULL;
+  *count = 0;
+
+  for (;;) {
+    if (*count == capacity) {
+      capacity = capacity ? capacity * 2 : 4096;
+      trace_record* grown =
+          (trace_record*)realloc(records, capacity * sizeof(trace_record));
+      if (!grown) {
+        free(records);
+        fclose(file);
+        return NULL;
+      }
+      records = grown;
+    }
+
+    size_t got = fread(records + *count, sizeof(trace_record),
+                       capacity - *count, file);
+    *count += got;
+    if (got == 0) {
+      break;
+    }
+  }
+
+  fclose(file);
+  return records;
+}
+
+static int replay_load(const char* path, replay_trace* trace) {
+  size_t count;
+  trace_record* records = replay_read(path, &count);
+
+  if (!records) {
+    return 0;
+  }
+
+  size_t capacity = 16;
+  while (capacity < 2 * count) {
+    capacity <<= 1;
+  }
+
+  size_t* order = (size_t*)malloc(count * sizeof(size_t));
+  uint32_t* free_slots = (uint32_t*)malloc(count * sizeof(uint32_t) + 1);
+  size_t* sizes = (size_t*)malloc(count * sizeof(size_t) + 1);
+  replay_map map = {.keys = (uint64_t*)calloc(capacity, sizeof(uint64_t)),
+                    .slots = (uint32_t*)malloc(capacity * sizeof(uint32_t)),
+                    .mask = capacity - 1};
+  /* Slots released by a moving realloc, keyed by thread, until the
+     thread's REALLOC record says where they went. */
+  replay_map moving = {
+      .keys = (uint64_t*)calloc(capacity, sizeof(uint64_t)),
+      .slots = (uint32_t*)malloc(capacity * sizeof(uint32_t)),
+      .mask = capacity - 1};
+
+  memset(trace, 0, sizeof(*trace));
+  trace->ops = (replay_op*)malloc(count * sizeof(replay_op) + 1);
+  trace->max_alignment = sizeof(void*);
+
+  int ok = order && free_slots && sizes && map.keys && map.slots &&
+           moving.keys && moving.slots && trace->ops;
+
+  if (ok) {
+    for (size_t i = 0; i < count; i++) {
+      order[i] = i;
+    }
+    replay_sort_base = records;
+    qsort(order, count, sizeof(size_t), replay_compare_records);
+  }
+
+  size_t free_count = 0;
+  size_t live = 0;
+
+  for (size_t i = 0; ok && i < count; i++) {
+    trace_record* record = &records[order[i]];
+    uint64_t thread_key = ((uint64_t)record->thread + 1) << 4;
+    uint32_t slot = REPLAY_SLOT_NONE;
+
+    if (record->op == TRACE_OP_RELEASE) {
+      slot = replay_map_remove(&map, record->ptr);
+      if (slot != REPLAY_SLOT_NONE) {
+        replay_map_insert(&moving, thread_key, slot);
+      }
+      continue;
+    }
+
+    if (record->op == TRACE_OP_REALLOC) {
+      slot = replay_map_remove(&moving, thread_key);
+    }
+
+    if (record->op == TRACE_OP_FREE ||
+        (record->op == TRACE_OP_REALLOC && slot == REPLAY_SLOT_NONE)) {
+      uint64_t key = record->op == TRACE_OP_FREE ? record->ptr
+                                                 : record->old_ptr;
+      slot = replay_map_remove(&map, key);
+      if (slot == REPLAY_SLOT_NONE && record->op == TRACE_OP_FREE) {
+        continue;
+      }
+    }
+
+    if (record->op == TRACE_OP_FREE) {
+      replay_op op = {.op = TRACE_OP_FREE, .slot = slot};
+      trace->ops[trace->op_count++] = op;
+      free_slots[free_count++] = slot;
+      live -= sizes[slot];
+      continue;
+    }
+
+    uint8_t kind = TRACE_OP_REALLOC;
+    if (slot == REPLAY_SLOT_NONE) {
+      kind = TRACE_OP_ALLOC;
+      slot = free_count ? free_slots[--free_count]
+                        : (uint32_t)trace->slot_count++;
+    } else {
+      live -= sizes[slot];
+    }
+
+    replay_op op = {.op = kind,
+                    .alignment_log2 = record->alignment_log2,
+                    .slot = slot,
+                    .size = (size_t)record->size};
+    trace->ops[trace->op_count++] = op;
+    replay_map_insert(&map, record->ptr, slot);
+
+    sizes[slot] = (size_t)record->size;
+    live += sizes[slot];
+
+    if (live > trace->peak_live) {
+      trace->peak_live = live;
+    }
+    if (op.size > trace->max_size) {
+      trace->max_size = op.size;
+    }
+    if (((size_t)1 << op.alignment_log2) > trace->max_alignment) {
+      trace->max_alignment = (size_t)1 << op.alignment_log2;
+    }
+  }
+
+  free(records);
+  free(order);
+  free(free_slots);
+  free(sizes);
+  free(map.keys);
+  free(map.slots);
+  free(moving.keys);
+  free(moving.slots);
+
+  if (!ok) {
+    free(trace->ops);
+    fprintf(stderr, "replay: out of memory\n");
+  }
+
+  return ok;
+}
+
+/* Replay */
+
+typedef struct replay_result {
+  double seconds;
+  size_t failures;
+  size_t peak_bytes;
+} replay_result;
+
+static uint64_t replay_time_ns(void) {
+#if defined(_WIN32)
+  LARGE_INTEGER counter, frequency;
+  QueryPerformanceCounter(&counter);
+  QueryPerformanceFrequency(&frequency);
+  return (uint64_t)((double)counter.QuadPart * 1e9 /
+                    (double)frequency.QuadPart);
+#else
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t)ts.tv_sec * 1000000000ull + (uint64_t)ts.tv_nsec;
+#endif
+}
+
+/* With sample set, usage is read after every op to find the peak; timed
+   passes leave it unset so the measurement is the allocator alone. */
+static int replay_run(replay_subject* subject, const replay_trace* trace,
+                      void** ptrs, size_t* sizes, int sample,
+                      replay_result* result) {
+  memset(&subject->counter, 0, sizeof(subject->counter));
+  allocator backing = {.alloc = replay_counter_alloc,
+                       .realloc = replay_counter_realloc,
+                       .free = replay_counter_free,
+                       .ctx = &subject->counter};
+  subject->backing = backing;
+
+  if (!subject->create(subject, trace)) {
+    return 0;
+  }
+
+  memset(ptrs, 0, trace->slot_count * sizeof(void*));
+  memset(result, 0, sizeof(*result));
+
+  allocator* a = &subject->alloc;
+  uint64_t start = replay_time_ns();
+
+  for (size_t i = 0; i < trace->op_count; i++) {
+    const replay_op* op = &trace->ops[i];
+    size_t alignment = (size_t)1 << op->alignment_log2;
+
+    if (op->op == TRACE_OP_FREE) {
+      if (ptrs[op->slot]) {
+        alloc_free(a, ptrs[op->slot], sizes[op->slot]);
+        ptrs[op->slot] = NULL;
+      }
+    } else if (op->op == TRACE_OP_REALLOC && ptrs[op->slot]) {
+      void* ptr = alloc_realloc(a, ptrs[op->slot], sizes[op->slot], op->size,
+                                alignment);
+      if (ptr) {
+        ptrs[op->slot] = ptr;
+        sizes[op->slot] = op->size;
+      } else {
+        result->failures++;
+      }
+    } else {
+      ptrs[op->slot] = alloc_alloc(a, op->size, alignment);
+      sizes[op->slot] = op->size;
+      if (!ptrs[op->slot]) {
+        result->failures++;
+      }
+    }
+
+    if (sample) {
+      size_t usage = subject->usage(subject);
+      if (usage > result->peak_bytes) {
+        result->peak_bytes = usage;
+      }
+    }
+  }
+
+  result->seconds = (double)(replay_time_ns() - start) / 1e9;
+
+  for (size_t slot = 0; slot < trace->slot_count; slot++) {
+    if (ptrs[slot]) {
+      alloc_free(a, ptrs[slot], sizes[slot]);
+    }
+  }
+
+  subject->destroy(subject);
+  return 1;
+}
+
+static void replay_report(replay_subject* subject, const replay_trace* trace,
+                          void** ptrs, size_t* sizes) {
+  replay_result peak;
+
+  if (!replay_run(subject, trace, ptrs, sizes, 1, &peak)) {
+    printf("%s,%zu,0,0,%zu,0,0,0\n", subject->name, trace->op_count,
+           trace->peak_live);
+    return;
+  }
+
+  double best = 0.0;
+
+  for (size_t repeat = 0; repeat < REPLAY_REPEATS; repeat++) {
+    replay_result result;
+    if (replay_run(subject, trace, ptrs, sizes, 0, &result) &&
+        (best == 0.0 || result.seconds < best)) {
+      best = result.seconds;
+    }
+  }
+
+  double fragmentation =
+      peak.peak_bytes
+          ? 1.0 - (double)trace->peak_live / (double)peak.peak_bytes
+          : 0.0;
+
+  printf("%s,%zu,%.6f,%.0f,%zu,%zu,%.3f,%zu\n", subject->name,
+         trace->op_count, best,
+         best > 0.0 ? (double)trace->op_count / best : 0.0, trace->peak_live,
+         peak.peak_bytes, fragmentation < 0.0 ? 0.0 : fragmentation,
+         peak.failures);
+  fflush(stdout);
+}
+
+int main(int argc, char** argv) {
+  const char* path = NULL;
+  const char* filter = NULL;
+
+  for (int i = 1; i < argc; i++) {
+    if (strcmp(argv[i], "--filter") == 0 && i + 1 < argc) {
+      filter = argv[++i];
+    } else if (!path && argv[i][0] != '-') {
+      path = argv[i];
+    } else {
+      path = NULL;
+      break;
+    }
+  }
+
+  if (!path) {
+    fprintf(stderr, "usage: %s trace.bin [--filter name]\n", argv[0]);
+    return 1;
+  }
+
+  replay_trace trace;
+  if (!replay_load(path, &trace)) {
+    return 1;
+  }
+
+  void** ptrs = (void**)malloc(trace.slot_count * sizeof(void*) + 1);
+  size_t* sizes = (size_t*)malloc(trace.slot_count * sizeof(size_t) + 1);
+
+  if (!ptrs || !sizes) {
+    fprintf(stderr, "replay: out of memory\n");
+    return 1;
+  }
+
+  printf("allocator,ops,seconds,ops_per_sec,peak_live_bytes,peak_bytes,"
+         "fragmentation,failures\n");
+
+  for (size_t s = 0; s < REPLAY_SUBJECT_COUNT; s++) {
+    if (!filter || strstr(replay_subjects[s].name, filter)) {
+      replay_report(&replay_subjects[s], &trace, ptrs, sizes);
+    }
+  }
+
+  free(ptrs);
+  free(sizes);
+  free(trace.ops);
+  return 0;
+}
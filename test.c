@@ -1,6 +1,51 @@
 #include "alloc.h"
 #include <stdio.h>
 
+typedef struct heap_worker {
+  allocator* heap_alloc;
+  heap_allocator* heap;
+  void* remote;
+  void* kept;
+  thread_heap* local;
+} heap_worker;
+
+#if defined(_WIN32)
+static DWORD WINAPI heap_worker_main(LPVOID param) {
+#else
+static void* heap_worker_main(void* param) {
+#endif
+  heap_worker* worker = (heap_worker*)param;
+
+  if (worker->remote) {
+    alloc_free(worker->heap_alloc, worker->remote, 100);
+  }
+
+  void* scratch = alloc_alloc(worker->heap_alloc, 100, 8);
+  worker->kept = alloc_alloc(worker->heap_alloc, 100, 8);
+  worker->local = (thread_heap*)alloc_tls_get(worker->heap->key);
+  alloc_free(worker->heap_alloc, scratch, 100);
+  return 0;
+}
+
+static void heap_worker_run(heap_worker* worker) {
+#if defined(_WIN32)
+  HANDLE thread = CreateThread(NULL, 0, heap_worker_main, worker, 0, NULL);
+  WaitForSingleObject(thread, INFINITE);
+  CloseHandle(thread);
+#else
+  pthread_t thread;
+  pthread_create(&thread, NULL, heap_worker_main, worker);
+  pthread_join(thread, NULL);
+#endif
+}
+
+#if defined(ALLOC_DEBUG)
+static void debug_report(const char* message, void* ptr) {
+  (void)ptr;
+  printf("debug allocator reported: %s\n", message);
+}
+#endif
+
 int main(void) {
   printf("=== c allocator ===\n");
   allocator* c_alloc = c_allocator();
@@ -17,6 +62,31 @@ int main(void) {
   printf("\n");
   alloc_destroy(c_alloc, nums, 5 * sizeof(int));
 
+  uint8_t* simd = (uint8_t*)alloc_alloc(c_alloc, 100, 64);
+  uint8_t* resized = (uint8_t*)alloc_realloc(c_alloc, simd, 100, 104, 64);
+  printf("over-aligned realloc kept block: %s, aligned: %s\n",
+         resized == simd ? "yes" : "no",
+         ((uintptr_t)resized & 63) == 0 ? "yes" : "no");
+  alloc_free(c_alloc, resized, 104);
+
+  uint8_t* wide = (uint8_t*)alloc_alloc(c_alloc, 64, 64);
+  int wide_aligned = wide != NULL;
+  for (size_t size = 64; wide && size < 64 * 1024; size *= 2) {
+    memset(wide, 0x5a, size);
+    uint8_t* grown = (uint8_t*)alloc_realloc(c_alloc, wide, size, size * 2, 64);
+    if (!grown) {
+      alloc_free(c_alloc, wide, size);
+      wide = NULL;
+      wide_aligned = 0;
+      break;
+    }
+    wide_aligned &= ((uintptr_t)grown & 63) == 0 && grown[size - 1] == 0x5a;
+    wide = grown;
+  }
+  printf("over-aligned growth stays aligned: %s\n",
+         wide_aligned ? "yes" : "no");
+  alloc_free(c_alloc, wide, 64 * 1024);
+
   printf("\n=== arena allocator ===\n");
   uint8_t arena_buffer[1024];
   arena_allocator arena;
@@ -33,6 +103,134 @@ int main(void) {
   arena_allocator_reset(&arena);
   printf("arena reset, offset: %zu\n", arena.offset);
 
+  printf("\n=== growable arena allocator ===\n");
+  arena_allocator growable;
+  arena_allocator_init_growable(&growable, c_allocator(), 256, 4096);
+  allocator growable_alloc = arena_allocator_get(&growable);
+
+  for (int i = 0; i < 64; i++) {
+    alloc_alloc(&growable_alloc, 48, 16);
+  }
+
+  size_t block_count = 0;
+  for (arena_block* blk = growable.blocks; blk; blk = blk->prev) {
+    block_count++;
+  }
+  printf("allocated 64 objects across %zu blocks\n", block_count);
+
+  growable.keep_largest = 1;
+  arena_allocator_reset(&growable);
+  printf("reset kept largest block: %zu bytes, blocks: %s\n",
+         growable.buffer_size, growable.blocks->prev ? "many" : "one");
+
+  arena_allocator_destroy(&growable);
+
+  printf("\n=== zeroed allocation ===\n");
+  int* zeroed = (int*)alloc_calloc(c_alloc, 16, sizeof(int));
+  printf("calloc zeroed: %s\n",
+         zeroed[0] == 0 && zeroed[15] == 0 ? "yes" : "no");
+  alloc_free(c_alloc, zeroed, 16 * sizeof(int));
+
+  arena_allocator zeroing;
+  arena_allocator_init_growable(&zeroing, c_allocator(), 1 << 20, 1 << 20);
+  arena_allocator_set_zero_on_reset(&zeroing, 1);
+  allocator zeroing_alloc = arena_allocator_get(&zeroing);
+
+  uint8_t* dirty = (uint8_t*)alloc_alloc(&zeroing_alloc, 512 * 1024, 64);
+  memset(dirty, 0xab, 512 * 1024);
+  arena_allocator_reset(&zeroing);
+  printf("reset pre-zeroed arena, dirty up to: %zu\n", zeroing.dirty);
+
+  uint8_t* fresh = (uint8_t*)alloc_alloc_zeroed(&zeroing_alloc, 512 * 1024, 64);
+  printf("zeroed arena alloc: %s\n",
+         fresh[0] == 0 && fresh[512 * 1024 - 1] == 0 ? "yes" : "no");
+  arena_allocator_destroy(&zeroing);
+
+  printf("\n=== page allocator ===\n");
+  page_allocator pages;
+  page_allocator_init(&pages, PAGE_ALLOCATOR_TRANSPARENT_HUGE);
+  allocator page_alloc = page_allocator_get(&pages);
+
+  arena_allocator paged;
+  arena_allocator_init_growable(&paged, &page_alloc, 1 << 20, 1 << 24);
+  allocator paged_alloc = arena_allocator_get(&paged);
+
+  void* region = alloc_alloc(&paged_alloc, 3 << 20, 64);
+  printf("mapped 3 MiB from pages: %s, page size: %zu\n",
+         region ? "yes" : "no", pages.page_size);
+  arena_allocator_destroy(&paged);
+
+  printf("\n=== virtual arena allocator ===\n");
+  virtual_arena_allocator varena;
+  virtual_arena_allocator_init(&varena, (size_t)1 << 32);
+  allocator varena_alloc = virtual_arena_allocator_get(&varena);
+
+  uint8_t* vec = (uint8_t*)alloc_alloc(&varena_alloc, 1024, 16);
+  uint8_t* grown =
+      (uint8_t*)alloc_realloc(&varena_alloc, vec, 1024, 8 << 20, 16);
+  printf("grew in place: %s, committed: %zu bytes\n",
+         grown == vec ? "yes" : "no", varena.committed);
+
+  virtual_arena_allocator_reset(&varena);
+  printf("reset, committed: %zu bytes\n", varena.committed);
+  virtual_arena_allocator_destroy(&varena);
+
+  printf("\n=== persistent arena ===\n");
+  typedef struct index_entry {
+    uint32_t key;
+    alloc_relptr next;
+  } index_entry;
+
+  persistent_arena pa;
+  int opened = persistent_arena_open(&pa, "test_persistent.bin", 1 << 16, 1,
+                                     NULL, 0);
+  allocator pa_alloc = persistent_arena_get(&pa);
+  index_entry* head = NULL;
+
+  for (uint32_t key = 1; key <= 3; key++) {
+    index_entry* entry = (index_entry*)alloc_alloc(
+        &pa_alloc, sizeof(index_entry), sizeof(uint64_t));
+    entry->key = key;
+    alloc_relptr_set(&entry->next, head);
+    head = entry;
+  }
+
+  persistent_arena_set_root(&pa, head);
+  persistent_arena_commit(&pa);
+  printf("created: %s, used: %zu bytes\n",
+         opened == PERSISTENT_ARENA_CREATED ? "yes" : "no", pa.arena.offset);
+  persistent_arena_close(&pa);
+
+  opened = persistent_arena_open(&pa, "test_persistent.bin", 1 << 16, 1, NULL,
+                                 PERSISTENT_ARENA_VERIFY);
+  uint32_t key_sum = 0;
+  for (index_entry* entry = (index_entry*)persistent_arena_root(&pa); entry;
+       entry = (index_entry*)alloc_relptr_get(&entry->next)) {
+    key_sum += entry->key;
+  }
+  printf("reloaded: %s, key sum: %u, used: %zu bytes\n",
+         opened == PERSISTENT_ARENA_LOADED ? "yes" : "no", key_sum,
+         pa.arena.offset);
+  persistent_arena_close(&pa);
+
+  opened = persistent_arena_open(&pa, "test_persistent.bin", 1 << 16, 2, NULL,
+                                 0);
+  printf("version mismatch reported: %s\n",
+         opened == PERSISTENT_ARENA_MISMATCH ? "yes" : "no");
+
+  opened = persistent_arena_open(&pa, "test_persistent.bin", 1 << 16, 1, NULL,
+                                 PERSISTENT_ARENA_VERIFY);
+  printf("mismatched open left file intact: %s\n",
+         opened == PERSISTENT_ARENA_LOADED ? "yes" : "no");
+  persistent_arena_close(&pa);
+
+  opened = persistent_arena_open(&pa, "test_persistent.bin", 1 << 16, 2, NULL,
+                                 PERSISTENT_ARENA_REINIT);
+  printf("version mismatch rebuilt on request: %s\n",
+         opened == PERSISTENT_ARENA_CREATED ? "yes" : "no");
+  persistent_arena_close(&pa);
+  remove("test_persistent.bin");
+
   printf("\n=== pool allocator ===\n");
   uint8_t pool_buffer[256];
   pool_allocator pool;
@@ -50,6 +248,78 @@ int main(void) {
   void* p4 = alloc_alloc(&pool_alloc, 32, 1);
   printf("reallocated chunk: %p (should reuse freed chunk)\n", p4);
 
+  void* batch[4];
+  size_t got = alloc_alloc_batch(&pool_alloc, 32, 8, batch, 4);
+  printf("batch allocated %zu chunks\n", got);
+  alloc_free_batch(&pool_alloc, batch, 32, got);
+  printf("batch freed, next chunk: %p\n", (void*)pool.free_list);
+  printf("bind rejects a pool without whole pages: %s\n",
+         pool_allocator_bind_node(&pool, 0) ? "no" : "yes");
+
+  arena_allocator_reset(&arena);
+  got = alloc_alloc_batch(&arena_alloc, 24, 8, batch, 4);
+  printf("arena batch allocated %zu objects, arena used: %zu bytes\n", got,
+         arena.offset);
+
+  uint8_t padded_buffer[8 * 64 + 63];
+  pool_allocator padded;
+  pool_allocator_init_aligned(&padded, padded_buffer, 48, 8,
+                              ALLOC_CACHE_LINE_SIZE);
+  allocator padded_alloc = pool_allocator_get(&padded);
+
+  void* line = alloc_alloc(&padded_alloc, 48, 64);
+  printf("cache-line pool stride: %zu, chunk aligned: %s\n",
+         padded.chunk_stride, ((uintptr_t)line & 63) == 0 ? "yes" : "no");
+
+  pool_allocator growing;
+  pool_allocator_init_growable(&growing, c_allocator(), 32, 64, 8);
+  allocator growing_alloc = pool_allocator_get(&growing);
+  pool_allocator_bind_node(&growing, 0);
+  printf("growable pool binds later blocks: %s\n",
+         growing.numa_node == 0 ? "yes" : "no");
+
+  void* chained[256];
+  for (int i = 0; i < 256; i++) {
+    chained[i] = alloc_alloc(&growing_alloc, 32, 8);
+  }
+  printf("growable pool chunks: %zu for %zu live\n", growing.chunk_count,
+         growing.live_count);
+
+  alloc_free_batch(&growing_alloc, chained, 32, 256);
+  printf("trim released %zu blocks\n", pool_allocator_trim(&growing));
+  pool_allocator_destroy(&growing);
+
+  printf("\n=== handle pool ===\n");
+  handle_pool entities;
+  handle_pool_init(&entities, c_allocator(), sizeof(int), sizeof(int), 2);
+
+  pool_handle handles[8];
+  for (int i = 0; i < 8; i++) {
+    *(int*)handle_pool_create(&entities, &handles[i]) = i;
+  }
+
+  handle_pool_release(&entities, handles[2]);
+  handle_pool_release(&entities, handles[5]);
+  printf("stale handle rejected: %s\n",
+         handle_pool_get(&entities, handles[2]) == NULL ? "yes" : "no");
+  printf("handle 7 still resolves: %d\n",
+         *(int*)handle_pool_get(&entities, handles[7]));
+
+  pool_handle reused;
+  handle_pool_create(&entities, &reused);
+  printf("reused slot gets new handle: %s\n",
+         reused != handles[5] && !handle_pool_valid(&entities, handles[5])
+             ? "yes"
+             : "no");
+
+  int live_sum = 0;
+  for (size_t i = 0; i < handle_pool_count(&entities); i++) {
+    live_sum += *(int*)handle_pool_at(&entities, i);
+  }
+  printf("live objects: %zu, sum: %d\n", handle_pool_count(&entities),
+         live_sum);
+  handle_pool_destroy(&entities);
+
   printf("\n=== stack allocator ===\n");
   uint8_t stack_buffer[512];
   stack_allocator stack;
@@ -70,6 +340,32 @@ int main(void) {
   stack_allocator_restore(&stack, mark);
   printf("restored to marker, offset: %zu\n", stack.offset);
 
+  printf("\n=== double-ended stack allocator ===\n");
+  uint8_t double_buffer[256];
+  double_stack_allocator frame;
+  double_stack_allocator_init(&frame, double_buffer, sizeof(double_buffer));
+  allocator level_alloc = double_stack_allocator_get_front(&frame);
+  allocator frame_alloc = double_stack_allocator_get_back(&frame);
+
+  alloc_alloc(&level_alloc, 100, 8);
+  stack_marker frame_mark = double_stack_allocator_mark_back(&frame);
+  void* temp = alloc_alloc(&frame_alloc, 100, 16);
+  printf("back allocation aligned: %s\n",
+         ((uintptr_t)temp & 15) == 0 ? "yes" : "no");
+  printf("overlap rejected: %s\n",
+         alloc_alloc(&level_alloc, 100, 8) == NULL ? "yes" : "no");
+
+  double_stack_allocator_restore_back(&frame, frame_mark);
+  printf("remaining after frame restore: %zu\n",
+         double_stack_allocator_remaining(&frame));
+
+  size_t before_back = double_stack_allocator_remaining(&frame);
+  void* padded_back = alloc_alloc(&frame_alloc, 20, 32);
+  alloc_free(&frame_alloc, padded_back, 20);
+  printf("padded back free restored: %s\n",
+         double_stack_allocator_remaining(&frame) == before_back ? "yes"
+                                                                  : "no");
+
   printf("\n=== scratch allocator ===\n");
   scratch_allocator scratch;
   scratch_allocator_init(&scratch, c_allocator());
@@ -86,6 +382,39 @@ int main(void) {
 
   scratch_allocator_destroy(&scratch);
 
+  scratch_allocator chunked;
+  scratch_allocator_init_chunked(&chunked, c_allocator(), 4096);
+  allocator chunked_alloc = scratch_allocator_get(&chunked);
+
+  for (int i = 0; i < 100; i++) {
+    alloc_create_array(&chunked_alloc, 4, sizeof(int));
+  }
+  alloc_alloc(&chunked_alloc, 2048, 8);
+  printf("chunked scratch: 101 objects in %zu backing allocations\n",
+         chunked.allocation_count);
+  scratch_allocator_destroy(&chunked);
+
+  printf("\n=== temp arenas ===\n");
+  temp_arena outer = temp_begin(NULL);
+  allocator outer_alloc = arena_allocator_get(outer.arena);
+  void* kept = alloc_alloc(&outer_alloc, 256, 16);
+
+  temp_arena inner = temp_begin(outer.arena);
+  allocator inner_alloc = arena_allocator_get(inner.arena);
+  alloc_alloc(&inner_alloc, 1024 * 1024, 16);
+  temp_end(inner);
+
+  printf("inner temp avoids conflict: %s\n",
+         inner.arena != outer.arena ? "yes" : "no");
+  temp_end(outer);
+
+  outer = temp_begin(NULL);
+  outer_alloc = arena_allocator_get(outer.arena);
+  printf("temp_end rewinds: %s\n",
+         alloc_alloc(&outer_alloc, 256, 16) == kept ? "yes" : "no");
+  temp_end(outer);
+  temp_thread_release();
+
   printf("\n=== freelist allocator ===\n");
   uint8_t freelist_buffer[1024];
   freelist_allocator freelist;
@@ -101,7 +430,364 @@ int main(void) {
   printf("freed middle block\n");
 
   void* f4 = alloc_alloc(&freelist_alloc, 100, 8);
-  printf("allocated new block (should fit in freed space)\n");
+  printf("allocated new block (should fit in freed space): %s\n",
+         f4 == f2 ? "yes" : "no");
+
+  alloc_free(&freelist_alloc, f1, 64);
+  alloc_free(&freelist_alloc, f3, 64);
+  printf("freed outer blocks, fragmentation: %.2f\n",
+         freelist_allocator_fragmentation(&freelist));
+
+  alloc_free(&freelist_alloc, f4, 100);
+  printf("freed all blocks, free bytes: %zu, fragmentation: %.2f\n",
+         freelist.free_bytes, freelist_allocator_fragmentation(&freelist));
+
+  void* g1 = alloc_alloc(&freelist_alloc, 64, 8);
+  void* g2 = alloc_realloc(&freelist_alloc, g1, 64, 512, 8);
+  printf("grew block in place: %s\n", g1 == g2 ? "yes" : "no");
+  void* g3 = alloc_realloc(&freelist_alloc, g2, 512, 32, 8);
+  printf("shrank block in place: %s, free bytes: %zu\n",
+         g2 == g3 ? "yes" : "no", freelist.free_bytes);
+  alloc_free(&freelist_alloc, g3, 32);
+
+
+  static uint8_t realtime_buffer[64 * 1024];
+  freelist_allocator realtime;
+  freelist_latency latency;
+  freelist_allocator_init_realtime(&realtime, realtime_buffer,
+                                   sizeof(realtime_buffer), &latency, 0);
+  allocator realtime_alloc = freelist_allocator_get(&realtime);
+
+  for (int i = 0; i < 100; i++) {
+    void* rt = alloc_alloc(&realtime_alloc, (size_t)(i * 37 % 900) + 1, 16);
+    alloc_free(&realtime_alloc, rt, (size_t)(i * 37 % 900) + 1);
+  }
+  printf("realtime: oversized request rejected: %s\n",
+         alloc_alloc(&realtime_alloc, SIZE_MAX - 8, 8) == NULL ? "yes" : "no");
+
+  uint64_t timed_allocs = 0;
+  for (int i = 0; i < FREELIST_LATENCY_BUCKETS; i++) {
+    timed_allocs += latency.alloc_cycles[i];
+  }
+  printf("realtime: timed allocs: %llu\n", (unsigned long long)timed_allocs);
+
+  printf("\n=== buddy allocator ===\n");
+  buddy_allocator buddy;
+  buddy_allocator_init_backing(&buddy, c_alloc, 64 * 1024, 64);
+  allocator buddy_alloc = buddy_allocator_get(&buddy);
+  size_t buddy_free = buddy.free_bytes;
+
+  void* b1 = alloc_alloc(&buddy_alloc, 100, 8);
+  void* b2 = alloc_alloc(&buddy_alloc, 4096, 8);
+  void* b3 = alloc_alloc(&buddy_alloc, 64, 1024);
+  printf("blocks naturally aligned: %s\n",
+         ((uintptr_t)b1 % 128 == 0 && (uintptr_t)b2 % 4096 == 0 &&
+          (uintptr_t)b3 % 1024 == 0)
+             ? "yes"
+             : "no");
+
+  void* b4 = alloc_realloc(&buddy_alloc, b2, 4096, 1000, 8);
+  printf("shrank block in place: %s\n", b4 == b2 ? "yes" : "no");
+
+  alloc_free(&buddy_alloc, b1, 100);
+  alloc_free(&buddy_alloc, b4, 1000);
+  alloc_free(&buddy_alloc, b3, 64);
+  printf("buddies coalesced: %s, largest free: %zu\n",
+         buddy.free_bytes == buddy_free ? "yes" : "no",
+         buddy_allocator_largest_free(&buddy));
+  buddy_allocator_destroy(&buddy);
+
+  buddy_allocator oversized;
+  printf("oversized region rejected: %s\n",
+         buddy_allocator_init_backing(&oversized, c_alloc, SIZE_MAX, 64) == 0
+             ? "yes"
+             : "no");
+
+  printf("\n=== tcache allocator ===\n");
+  tcache_allocator tcache;
+  tcache_allocator_init(&tcache, c_allocator());
+  allocator tcache_alloc = tcache_allocator_get(&tcache);
+
+  void* t1 = alloc_alloc(&tcache_alloc, 40, 8);
+  alloc_free(&tcache_alloc, t1, 40);
+  void* t2 = alloc_alloc(&tcache_alloc, 48, 8);
+  printf("reused cached block: %s\n", t1 == t2 ? "yes" : "no");
+  alloc_free(&tcache_alloc, t2, 48);
+
+  tcache_allocator_flush(&tcache);
+  printf("flushed thread cache\n");
+
+  tcache_allocator_set_limits(&tcache, 1000, 500, 256 * 1024);
+  printf("oversized limits clamped: %s\n",
+         tcache.magazine_size == TCACHE_MAGAZINE_CAPACITY &&
+                 tcache.batch_size == TCACHE_MAGAZINE_CAPACITY
+             ? "yes"
+             : "no");
+  void* churned[2 * TCACHE_MAGAZINE_CAPACITY];
+  for (int i = 0; i < 2 * TCACHE_MAGAZINE_CAPACITY; i++) {
+    churned[i] = alloc_alloc(&tcache_alloc, 64, 8);
+  }
+  for (int i = 0; i < 2 * TCACHE_MAGAZINE_CAPACITY; i++) {
+    alloc_free(&tcache_alloc, churned[i], 64);
+  }
+  tcache_allocator_destroy(&tcache);
+
+
+  printf("\n=== heap allocator ===\n");
+  heap_allocator heap;
+  heap_allocator_init(&heap, c_allocator());
+  allocator heap_alloc = heap_allocator_get(&heap);
+
+  void* h1 = alloc_alloc(&heap_alloc, 100, 8);
+  void* h2 = alloc_alloc(&heap_alloc, 100, 8);
+  thread_heap* home = (thread_heap*)alloc_tls_get(heap.key);
+
+  /* The worker frees h2 from its own thread and exits with one block live,
+   * which abandons its heap. */
+  heap_worker first = {&heap_alloc, &heap, h2, NULL, NULL};
+  heap_worker_run(&first);
+  printf("remote free queued, live: %zu\n", home->live);
+
+  void* h3 = alloc_alloc(&heap_alloc, 100, 8);
+  printf("drained on next alloc, live: %zu, reused: %s\n", home->live,
+         h3 == h2 ? "yes" : "no");
+  printf("exited worker heap abandoned: %s, live: %zu\n",
+         first.local->abandoned ? "yes" : "no", first.local->live);
+
+  /* Freeing the orphaned block queues it remotely; the next thread adopts
+   * the abandoned heap and drains it. */
+  alloc_free(&heap_alloc, first.kept, 100);
+  heap_worker second = {&heap_alloc, &heap, NULL, NULL, NULL};
+  heap_worker_run(&second);
+  printf("abandoned heap adopted: %s, live: %zu\n",
+         second.local == first.local ? "yes" : "no", second.local->live);
+  alloc_free(&heap_alloc, second.kept, 100);
+
+  void* over_aligned = alloc_alloc(&heap_alloc, 64, 8192);
+  printf("over-aligned small block: %s\n",
+         over_aligned && ((uintptr_t)over_aligned & 8191) == 0 ? "yes"
+                                                               : "no");
+  alloc_free(&heap_alloc, over_aligned, 64);
+
+  alloc_free(&heap_alloc, h1, 100);
+  alloc_free(&heap_alloc, h3, 100);
+  heap_allocator_destroy(&heap);
+
+  heap_allocator direct_heap;
+  heap_allocator_init(&direct_heap, c_allocator());
+  allocator direct_heap_alloc = heap_allocator_get(&direct_heap);
+  void* big = alloc_alloc(&direct_heap_alloc, 100000, 8);
+  alloc_free(&direct_heap_alloc, big, 100000);
+  printf("large-only thread created no heap: %s\n",
+         big && !alloc_tls_get(direct_heap.key) ? "yes" : "no");
+  heap_allocator_destroy(&direct_heap);
+
+  printf("\n=== concurrent pool allocator ===\n");
+  uint64_t cpool_buffer[32];
+  concurrent_pool_allocator cpool;
+  concurrent_pool_allocator_init(&cpool, cpool_buffer, 32, 8);
+  allocator cpool_alloc = concurrent_pool_allocator_get(&cpool);
+
+  void* c1 = alloc_alloc(&cpool_alloc, 32, 8);
+  alloc_free(&cpool_alloc, c1, 32);
+  void* c2 = alloc_alloc(&cpool_alloc, 32, 8);
+  printf("reused freed chunk: %s\n", c1 == c2 ? "yes" : "no");
+
+  concurrent_pool_stash stash;
+  concurrent_pool_stash_init(&stash, &cpool);
+  allocator stash_alloc = concurrent_pool_stash_get(&stash);
+
+  void* c3 = alloc_alloc(&stash_alloc, 32, 8);
+  printf("stash refilled with %zu chunks\n", stash.count + 1);
+  alloc_free(&stash_alloc, c3, 32);
+  concurrent_pool_stash_flush(&stash);
+  alloc_free(&cpool_alloc, c2, 32);
+
+  void* cbatch[4];
+  size_t cgot = alloc_alloc_batch(&cpool_alloc, 32, 8, cbatch, 4);
+  void* cheld = cbatch[1];
+  cbatch[1] = NULL;
+  alloc_free_batch(&cpool_alloc, cbatch, 32, cgot);
+  alloc_free(&cpool_alloc, cheld, 32);
+  cgot = alloc_alloc_batch(&cpool_alloc, 32, 8, cbatch, 4);
+  printf("batch free skipped NULL, refilled %zu chunks\n", cgot);
+  alloc_free_batch(&cpool_alloc, cbatch, 32, cgot);
+
+
+  printf("\n=== slab allocator ===\n");
+  slab_allocator slab;
+  slab_allocator_init(&slab, c_allocator(), NULL, 0, 0);
+  allocator slab_alloc = slab_allocator_get(&slab);
+
+  void* small = alloc_alloc(&slab_alloc, 40, 8);
+  void* medium = alloc_alloc(&slab_alloc, 700, 8);
+  void* large = alloc_alloc(&slab_alloc, 100000, 8);
+  printf("small class: %zu, medium class: %zu, large forwarded: %s\n",
+         slab.classes[slab_allocator_slab_of(&slab, small)->size_class].size,
+         slab.classes[slab_allocator_slab_of(&slab, medium)->size_class].size,
+         large ? "yes" : "no");
+
+  alloc_free(&slab_alloc, small, 40);
+  alloc_free(&slab_alloc, medium, 700);
+  alloc_free(&slab_alloc, large, 100000);
+
+  void* page_aligned = alloc_alloc(&slab_alloc, 40, 8192);
+  void* page_grown = alloc_realloc(&slab_alloc, page_aligned, 40, 80, 8192);
+  printf("over-aligned small request forwarded: %s\n",
+         page_grown && ((uintptr_t)page_grown & 8191) == 0 ? "yes" : "no");
+  alloc_free(&slab_alloc, page_grown, 80);
+  slab_allocator_destroy(&slab);
+
+
+#if defined(alloc_direct_alloc)
+  printf("\n=== direct dispatch ===\n");
+  uint8_t direct_buffer[1024];
+  arena_allocator direct_arena;
+  arena_allocator_init(&direct_arena, direct_buffer, sizeof(direct_buffer));
+
+  size_t direct_count = 0;
+  while (alloc_direct_alloc(&direct_arena, 16, 16)) {
+    direct_count++;
+  }
+  printf("direct arena allocations: %zu\n", direct_count);
+
+  pool_allocator direct_pool;
+  pool_allocator_init(&direct_pool, pool_buffer, 64, 4);
+  void* direct_chunk = alloc_direct_alloc(&direct_pool, 64, 8);
+  printf("direct pool chunk allocated: %s\n", direct_chunk ? "yes" : "no");
+  if (direct_chunk) {
+    alloc_direct_free(&direct_pool, direct_chunk, 64);
+  }
+  printf("direct pool live after free: %zu\n", direct_pool.live_count);
+#endif
+
+  printf("\n=== stats allocator ===\n");
+  stats_allocator stats;
+  stats_allocator_init(&stats, c_allocator());
+  allocator stats_alloc = stats_allocator_get(&stats);
+
+  void* s1 = alloc_alloc(&stats_alloc, 100, 8);
+  void* s2 = alloc_alloc(&stats_alloc, 200, 16);
+  s1 = alloc_realloc(&stats_alloc, s1, 100, 300, 8);
+  alloc_free(&stats_alloc, s2, 200);
+
+  stats_snapshot snapshot;
+  stats_allocator_snapshot(&stats, &snapshot);
+  printf("allocs: %llu, frees: %llu, live: %llu, peak: %llu\n",
+         (unsigned long long)snapshot.allocs,
+         (unsigned long long)snapshot.frees,
+         (unsigned long long)snapshot.live_bytes,
+         (unsigned long long)snapshot.peak_bytes);
+  alloc_free(&stats_alloc, s1, 300);
+
+  scratch_allocator sized;
+  scratch_allocator_init(&sized, &stats_alloc);
+  sized.batch_free = 1;
+  allocator sized_alloc = scratch_allocator_get(&sized);
+
+  void* r1 = alloc_alloc(&sized_alloc, 64, 8);
+  r1 = alloc_realloc(&sized_alloc, r1, 64, 128, 8);
+  alloc_alloc(&sized_alloc, 32, 8);
+  alloc_alloc(&sized_alloc, 32, 8);
+  scratch_allocator_destroy(&sized);
+
+  stats_allocator_snapshot(&stats, &snapshot);
+  printf("scratch over stats: live after destroy: %llu\n",
+         (unsigned long long)snapshot.live_bytes);
+
+  printf("arena peak: %zu, pool peak chunks: %zu, freelist peak: %zu\n",
+         arena.peak, pool.peak_count, freelist.peak_used);
+
+
+  printf("\n=== debug allocator ===\n");
+  debug_allocator dbg;
+  debug_allocator_init(&dbg, c_allocator());
+  allocator dbg_alloc = debug_allocator_get(&dbg);
+
+  char* guarded = (char*)alloc_alloc(&dbg_alloc, 24, 8);
+#if defined(ALLOC_DEBUG)
+  dbg.on_error = debug_report;
+  guarded[24] = 'x';
+  printf("overflow found by verify: %zu\n", debug_allocator_verify(&dbg));
+  guarded[24] = (char)DEBUG_CANARY_BYTE;
+  alloc_free(&dbg_alloc, guarded, 16);
+#else
+  printf("debug checks compiled out: %s\n",
+         dbg_alloc.ctx == c_allocator()->ctx ? "yes" : "no");
+  alloc_free(&dbg_alloc, guarded, 24);
+#endif
+  debug_allocator_destroy(&dbg);
+
+  printf("\n=== profile allocator ===\n");
+  profile_allocator prof;
+  profile_allocator_init(&prof, c_allocator(), 64 * 1024, 1024);
+  allocator prof_alloc = profile_allocator_get(&prof);
+
+  void* sampled[1024];
+  for (int i = 0; i < 1024; i++) {
+    sampled[i] = alloc_alloc(&prof_alloc, 4096, 8);
+  }
+  printf("sampled allocations recorded: %s\n",
+         prof.live_samples > 0 ? "yes" : "no");
+
+  for (int i = 0; i < 1024; i++) {
+    alloc_free(&prof_alloc, sampled[i], 4096);
+  }
+  printf("live samples after free: %zu\n", (size_t)prof.live_samples);
+
+  /* Churn leaves tombstones everywhere; probes must stay bounded. */
+  static char churn[64 * 1024];
+  for (int i = 0; i < 64 * 1024; i += 16) {
+    profile_allocator_record(&prof, churn + i, 16);
+    profile_allocator_forget(&prof, churn + i);
+  }
+  profile_allocator_record(&prof, churn, 16);
+  printf("sample found after churn: %s\n",
+         profile_allocator_take(&prof, churn, NULL) &&
+                 prof.live_samples == 0
+             ? "yes"
+             : "no");
+  profile_allocator_destroy(&prof);
+
+  printf("\n=== trace allocator ===\n");
+  trace_allocator trace;
+  trace_allocator_init(&trace, c_allocator(), "test_trace.bin", 0);
+  allocator trace_alloc = trace_allocator_get(&trace);
+
+  void* traced = alloc_alloc(&trace_alloc, 48, 16);
+  traced = alloc_realloc(&trace_alloc, traced, 48, 96, 16);
+  alloc_free(&trace_alloc, traced, 96);
+  void* emptied = alloc_alloc(&trace_alloc, 32, 8);
+  emptied = alloc_realloc(&trace_alloc, emptied, 32, 0, 8);
+  trace_allocator_destroy(&trace);
+
+  FILE* trace_file = fopen("test_trace.bin", "rb");
+  trace_file_header trace_header;
+  trace_record trace_records[8];
+  size_t traced_count = 0;
+  if (trace_file &&
+      fread(&trace_header, sizeof(trace_header), 1, trace_file) == 1) {
+    traced_count = fread(trace_records, sizeof(trace_record), 8, trace_file);
+  }
+
+  /* A realloc that moved also leaves a release record for the old block. */
+  int trace_ok = traced_count >= 5 &&
+                 trace_records[0].op == TRACE_OP_ALLOC &&
+                 trace_records[traced_count - 4].op == TRACE_OP_REALLOC &&
+                 trace_records[traced_count - 3].op == TRACE_OP_FREE;
+  printf("trace records: %zu, alloc/realloc/free in order: %s\n",
+         traced_count, trace_ok ? "yes" : "no");
+
+  /* realloc to zero bytes freed the block, so it must read as a free. */
+  int emptied_ok = !emptied && traced_count >= 2 &&
+                   trace_records[traced_count - 2].op == TRACE_OP_ALLOC &&
+                   trace_records[traced_count - 1].op == TRACE_OP_FREE &&
+                   trace_records[traced_count - 1].size == 32;
+  printf("realloc to zero traced as free: %s\n", emptied_ok ? "yes" : "no");
+  if (trace_file) {
+    fclose(trace_file);
+  }
+  remove("test_trace.bin");
 
   return 0;
 }
@@ -0,0 +1,179 @@
+#include "alloc.h"
+
+#include <cstdio>
+#include <cstring>
+#include <list>
+#include <map>
+#include <new>
+#include <vector>
+#if defined(ALLOC_HAS_PMR)
+#include <memory_resource>
+#include <string>
+#include <unordered_map>
+#endif
+
+static int failures = 0;
+
+static void check(const char* what, bool ok) {
+  std::printf("%s: %s\n", what, ok ? "yes" : "no");
+  failures += !ok;
+}
+
+static stats_allocator counted;
+static allocator counted_alloc;
+
+static allocator* counted_source() { return &counted_alloc; }
+
+static uint64_t counted_live() {
+  stats_snapshot snapshot;
+  stats_allocator_snapshot(&counted, &snapshot);
+  return snapshot.live_bytes;
+}
+
+int main() {
+  std::printf("=== templates ===\n");
+  alloc::arena<256> arena_storage;
+  void* first = arena_storage.allocate(24);
+  arena_marker arena_mark = arena_storage.mark();
+  void* second = arena_storage.allocate(100, 64);
+  check("arena allocations aligned",
+        first && second && (reinterpret_cast<uintptr_t>(first) &
+                            (alignof(max_align_t) - 1)) == 0 &&
+            (reinterpret_cast<uintptr_t>(second) & 63) == 0);
+  void* grown = arena_storage.reallocate(second, 100, 120, 64);
+  check("arena grows the last block in place", grown == second);
+  check("arena rejects overflow", arena_storage.allocate(256) == nullptr);
+  arena_storage.restore(arena_mark);
+  check("arena restores to a marker", arena_storage.used() == 24);
+  arena_storage.reset();
+  check("arena resets", arena_storage.used() == 0);
+
+  alloc::pool<48, 4, 64> chunk_pool;
+  void* chunks[4];
+  bool pool_ok = true;
+  for (void*& chunk : chunks) {
+    chunk = chunk_pool.allocate();
+    pool_ok = pool_ok && chunk &&
+              (reinterpret_cast<uintptr_t>(chunk) & 63) == 0;
+  }
+  check("pool chunks aligned to the template alignment", pool_ok);
+  check("pool stride rounded up", decltype(chunk_pool)::chunk_stride == 64);
+  check("pool exhausted after chunk_count", chunk_pool.allocate() == nullptr);
+  for (void* chunk : chunks) {
+    chunk_pool.deallocate(chunk);
+  }
+  check("pool rejects stricter alignment",
+        chunk_pool.allocate(48, 128) == nullptr);
+  check("pool returns every chunk", chunk_pool.live() == 0);
+
+  alloc::stack<256> frame;
+  stack_marker frame_mark = frame.mark();
+  void* top = frame.allocate(32);
+  frame.deallocate(top, 32);
+  check("stack frees the top allocation", frame.allocate(32) == top);
+  frame.restore(frame_mark);
+  check("stack restores to a marker", frame.native()->offset == 0);
+
+  alloc::freelist<4096> heap_storage;
+  size_t free_before = heap_storage.native()->free_bytes;
+  void* block = heap_storage.allocate(100);
+  void* resized = heap_storage.reallocate(block, 100, 400);
+  check("freelist reallocates", block && resized);
+  heap_storage.deallocate(resized, 400);
+  check("freelist returns every byte",
+        heap_storage.native()->free_bytes == free_before);
+
+  /* Under ALLOC_DEBUG with ASan, the storage must be usable again once the
+   * templates are destroyed. */
+  alignas(alignof(max_align_t)) uint8_t storage[sizeof(alloc::stack<256>)];
+  alloc::stack<256>* scoped = new (storage) alloc::stack<256>();
+  scoped->allocate(64);
+  scoped->~stack();
+  scoped = nullptr;
+  std::memset(storage, 0, sizeof(storage));
+  check("destroyed templates release their buffers", storage[0] == 0);
+
+  allocator view = arena_storage.get();
+  check("get exposes the vtable",
+        view.ctx == arena_storage.native() && alloc_alloc(&view, 8, 8));
+
+  std::printf("\n=== stl allocator ===\n");
+  stats_allocator_init(&counted, c_allocator());
+  counted_alloc = stats_allocator_get(&counted);
+
+  {
+    std::vector<int, alloc::stl_allocator<int, counted_source>> numbers;
+    for (int i = 0; i < 1000; i++) {
+      numbers.push_back(i);
+    }
+
+    std::map<int, int, std::less<int>,
+             alloc::stl_allocator<std::pair<const int, int>, counted_source>>
+        squares;
+    for (int i = 0; i < 100; i++) {
+      squares[i] = i * i;
+    }
+
+    check("containers allocate through the source", counted_live() > 0);
+    check("contents intact", numbers[999] == 999 && squares[99] == 9801);
+  }
+
+  /* A wrong deallocation size would leave live bytes behind. */
+  check("sized deallocation balanced", counted_live() == 0);
+
+  alloc::stl_allocator<int, counted_source> ints;
+  alloc::stl_allocator<long, counted_source> longs(ints);
+  check("instances compare equal", ints == longs);
+
+#if defined(__cpp_exceptions)
+  bool threw = false;
+  try {
+    ints.allocate(SIZE_MAX / 2);
+  } catch (const std::bad_alloc&) {
+    threw = true;
+  }
+  check("oversized allocate throws bad_alloc", threw);
+#endif
+
+#if defined(ALLOC_HAS_PMR)
+  std::printf("\n=== memory resource ===\n");
+  arena_allocator arena;
+  arena_allocator_init_growable(&arena, &counted_alloc, 4096, 1 << 20);
+  allocator arena_alloc = arena_allocator_get(&arena);
+  alloc::memory_resource arena_resource(&arena_alloc);
+
+  {
+    std::pmr::vector<std::pmr::string> words(&arena_resource);
+    for (int i = 0; i < 100; i++) {
+      words.emplace_back("a string too long for the small buffer");
+    }
+    check("pmr vector allocates from the arena", arena.offset > 0);
+    check("nested strings share the resource",
+          words[0].get_allocator().resource() == &arena_resource);
+  }
+  arena_allocator_destroy(&arena);
+
+  pool_allocator pool;
+  pool_allocator_init_growable(&pool, &counted_alloc, 64, 64, 16);
+  allocator pool_alloc = pool_allocator_get(&pool);
+  alloc::memory_resource pool_resource(&pool_alloc);
+  alloc::memory_resource same_pool(&pool_alloc);
+
+  {
+    std::pmr::list<int> values(&pool_resource);
+    for (int i = 0; i < 1000; i++) {
+      values.push_back(i);
+    }
+    check("pmr list nodes come from the pool", pool.live_count == 1000);
+  }
+
+  /* The pool frees by size, so every node must come back with its own. */
+  check("pmr sized deallocation returned every node", pool.live_count == 0);
+  check("resources over one allocator are equal",
+        pool_resource == same_pool && !(pool_resource == arena_resource));
+  pool_allocator_destroy(&pool);
+#endif
+
+  check("all bytes returned to the backing", counted_live() == 0);
+  return failures != 0;
+}